@@ -15,6 +15,15 @@ PG_MODULE_MAGIC;
 
 extern void _PG_init(void);
 
+PG_FUNCTION_INFO_V1(hstore_to_pllua);
+PG_FUNCTION_INFO_V1(pllua_to_hstore);
+
+static bool hstore_pllua_lazy = false;
+
+static int hstore_to_pllua_direct(lua_State *L, Datum val);
+static bool pllua_to_hstore_direct(lua_State *L, int nargs, int argbase,
+								   Datum *result, bool *isnull);
+
 /* Linkage to functions in hstore module */
 typedef HStore *(*hstoreUpgrade_t) (Datum orig);
 static hstoreUpgrade_t hstoreUpgrade_p;
@@ -36,6 +45,14 @@ typedef bool (*pllua_pairs_start_t) (lua_State *L, int nd, bool noerror);
 static pllua_pairs_start_t pllua_pairs_start_p;
 typedef int (*pllua_pairs_next_t) (lua_State *L);
 static pllua_pairs_next_t pllua_pairs_next_p;
+typedef void (*pllua_call_pg_t) (lua_State *L, void (*func)(void *), void *arg);
+static pllua_call_pg_t pllua_call_pg_p;
+typedef void (*pllua_register_fromsql_transform_t) (PGFunction func,
+													pllua_fromsql_transform_fn fn);
+static pllua_register_fromsql_transform_t pllua_register_fromsql_transform_p;
+typedef void (*pllua_register_tosql_transform_t) (PGFunction func,
+												  pllua_tosql_transform_fn fn);
+static pllua_register_tosql_transform_t pllua_register_tosql_transform_p;
 
 /*
  * Module initialize function: fetch function pointers for cross-module calls.
@@ -61,6 +78,26 @@ _PG_init(void)
 	EXTFUNC("$libdir/pllua", pllua_trampoline);
 	EXTFUNC("$libdir/pllua", pllua_pairs_start);
 	EXTFUNC("$libdir/pllua", pllua_pairs_next);
+	EXTFUNC("$libdir/pllua", pllua_call_pg);
+	EXTFUNC("$libdir/pllua", pllua_register_fromsql_transform);
+	EXTFUNC("$libdir/pllua", pllua_register_tosql_transform);
+
+	/*
+	 * Have pllua call our converters directly rather than going through the
+	 * SQL-level transform functions for every value.
+	 */
+	pllua_register_fromsql_transform_p(hstore_to_pllua, hstore_to_pllua_direct);
+	pllua_register_tosql_transform_p(pllua_to_hstore, pllua_to_hstore_direct);
+
+	DefineCustomBoolVariable("hstore_pllua.lazy",
+							 gettext_noop("Pass hstore values to Lua as lazy views rather than tables."),
+							 NULL,
+							 &hstore_pllua_lazy,
+							 false,
+							 PGC_USERSET, 0,
+							 NULL, NULL, NULL);
+
+	EmitWarningsOnPlaceholders("hstore_pllua");
 }
 
 
@@ -75,12 +112,12 @@ _PG_init(void)
 #define pllua_trampoline pllua_trampoline_p
 #define pllua_pairs_start pllua_pairs_start_p
 #define pllua_pairs_next pllua_pairs_next_p
+#define pllua_call_pg pllua_call_pg_p
 
 
-static int
-hstore_to_pllua_real(lua_State *L)
+static void
+hstore_to_pllua_table(lua_State *L, HStore *in)
 {
-	HStore	   *in = lua_touserdata(L, 1);
 	int			i;
 	int			count = HS_COUNT(in);
 	char	   *base = STRPTR(in);
@@ -101,7 +138,204 @@ hstore_to_pllua_real(lua_State *L)
 						   HSTORE_VALLEN(entries, i));
 		lua_rawset(L, -3);
 	}
+}
+
+/*
+ * Lazy views.
+ *
+ * With hstore_pllua.lazy on, an hstore is passed to Lua as a userdata holding
+ * a copy of the value, and indexing it does a binary search on the stored
+ * keys (which hstore keeps sorted by length, then bytes) instead of building
+ * a table up front. The first pairs() or assignment converts the view to a
+ * table, kept in the uservalue, which then serves all further accesses. A
+ * view that was never assigned to converts back by copying the original value.
+ */
+#define HSTORE_PLLUA_VIEW "hstore_pllua view"
+
+typedef struct hstore_pllua_view
+{
+	bool		materialized;
+	bool		modified;
+	Size		len;
+} hstore_pllua_view;
+
+#define HSV_HSTORE(v_) \
+	((HStore *) (((char *) (v_)) + MAXALIGN(sizeof(hstore_pllua_view))))
+
+static hstore_pllua_view *
+hstore_pllua_toview(lua_State *L, int nd)
+{
+	void	   *p = lua_touserdata(L, nd);
+
+	if (p && lua_getmetatable(L, nd))
+	{
+		luaL_getmetatable(L, HSTORE_PLLUA_VIEW);
+		if (!lua_rawequal(L, -1, -2))
+			p = NULL;
+		lua_pop(L, 2);
+		return p;
+	}
+	return NULL;
+}
+
+static hstore_pllua_view *
+hstore_pllua_checkview(lua_State *L, int nd)
+{
+	hstore_pllua_view *v = hstore_pllua_toview(L, nd);
+
+	if (!v)
+		luaL_error(L, "hstore view expected");
+	return v;
+}
+
+/*
+ * Convert the view to a table if not already done, and push the table.
+ */
+static void
+hstore_pllua_view_materialize(lua_State *L, int nd, hstore_pllua_view *v)
+{
+	nd = lua_absindex(L, nd);
+	if (!v->materialized)
+	{
+		hstore_to_pllua_table(L, HSV_HSTORE(v));
+		lua_pushvalue(L, -1);
+		lua_setuservalue(L, nd);
+		v->materialized = true;
+	}
+	else
+		lua_getuservalue(L, nd);
+}
+
+static int
+hstore_pllua_view_index(lua_State *L)
+{
+	hstore_pllua_view *v = hstore_pllua_checkview(L, 1);
+	HStore	   *hs = HSV_HSTORE(v);
+	char	   *base = STRPTR(hs);
+	HEntry	   *entries = ARRPTR(hs);
+	const char *key;
+	size_t		keylen;
+	int			lo = 0;
+	int			hi = HS_COUNT(hs);
+
+	if (v->materialized)
+	{
+		lua_getuservalue(L, 1);
+		lua_pushvalue(L, 2);
+		lua_rawget(L, -2);
+		return 1;
+	}
+
+	/* a table built from the hstore would only have string keys */
+	if (lua_type(L, 2) != LUA_TSTRING)
+		return 0;
+	key = lua_tolstring(L, 2, &keylen);
+
+	/* same ordering as hstoreFindKey */
+	while (lo < hi)
+	{
+		int			mid = lo + (hi - lo) / 2;
+		size_t		midlen = HSTORE_KEYLEN(entries, mid);
+		int			diff;
+
+		if (midlen == keylen)
+			diff = memcmp(HSTORE_KEY(entries, base, mid), key, keylen);
+		else
+			diff = (midlen > keylen) ? 1 : -1;
+
+		if (diff == 0)
+		{
+			if (HSTORE_VALISNULL(entries, mid))
+				lua_pushboolean(L, 0);
+			else
+				lua_pushlstring(L,
+								HSTORE_VAL(entries, base, mid),
+								HSTORE_VALLEN(entries, mid));
+			return 1;
+		}
+		else if (diff < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return 0;
+}
+
+static int
+hstore_pllua_view_newindex(lua_State *L)
+{
+	hstore_pllua_view *v = hstore_pllua_checkview(L, 1);
 
+	lua_settop(L, 3);
+	hstore_pllua_view_materialize(L, 1, v);
+	lua_pushvalue(L, 2);
+	lua_pushvalue(L, 3);
+	lua_rawset(L, -3);
+	v->modified = true;
+	return 0;
+}
+
+static int
+hstore_pllua_view_next(lua_State *L)
+{
+	lua_settop(L, 2);
+	if (lua_next(L, 1))
+		return 2;
+	lua_pushnil(L);
+	return 1;
+}
+
+static int
+hstore_pllua_view_pairs(lua_State *L)
+{
+	hstore_pllua_view *v = hstore_pllua_checkview(L, 1);
+
+	lua_pushcfunction(L, hstore_pllua_view_next);
+	hstore_pllua_view_materialize(L, 1, v);
+	lua_pushnil(L);
+	return 3;
+}
+
+static luaL_Reg hstore_pllua_view_mt[] = {
+	{ "__index", hstore_pllua_view_index },
+	{ "__newindex", hstore_pllua_view_newindex },
+	{ "__pairs", hstore_pllua_view_pairs },
+	{ NULL, NULL }
+};
+
+static void
+hstore_pllua_newview(lua_State *L, HStore *in)
+{
+	Size		len = VARSIZE(in);
+	hstore_pllua_view *v;
+
+	v = lua_newuserdata(L, MAXALIGN(sizeof(hstore_pllua_view)) + len);
+	v->materialized = false;
+	v->modified = false;
+	v->len = len;
+	memcpy(HSV_HSTORE(v), in, len);
+	if (luaL_newmetatable(L, HSTORE_PLLUA_VIEW))
+	{
+		luaL_setfuncs(L, hstore_pllua_view_mt, 0);
+		lua_pushboolean(L, 1);
+		lua_setfield(L, -2, "__metatable");
+	}
+	lua_setmetatable(L, -2);
+}
+
+static void
+hstore_to_pllua_value(lua_State *L, HStore *in)
+{
+	if (hstore_pllua_lazy)
+		hstore_pllua_newview(L, in);
+	else
+		hstore_to_pllua_table(L, in);
+}
+
+static int
+hstore_to_pllua_real(lua_State *L)
+{
+	hstore_to_pllua_value(L, lua_touserdata(L, 1));
 	return 1;
 }
 
@@ -117,6 +351,7 @@ static int
 pllua_to_hstore_real(lua_State *L)
 {
 	Pairs	   *pairs = NULL;
+	hstore_pllua_view *v;
 	int			idx = 0;
 	int			pcount = 0;
 	bool		metaloop;
@@ -131,6 +366,18 @@ pllua_to_hstore_real(lua_State *L)
 		return 2;
 	}
 
+	/*
+	 * An unmodified lazy view is passed back as itself, with a count of -1,
+	 * so that the original value can be copied.
+	 */
+	v = hstore_pllua_toview(L, 1);
+	if (v && !v->modified)
+	{
+		lua_pushinteger(L, -1);
+		lua_pushvalue(L, 1);
+		return 2;
+	}
+
 	lua_newtable(L); /* index 2: keys */
 	lua_newtable(L); /* index 3: vals */
 
@@ -198,7 +445,117 @@ pllua_to_hstore_real(lua_State *L)
 }
 
 
-PG_FUNCTION_INFO_V1(hstore_to_pllua);
+/*
+ * Build the hstore from the result of pllua_to_hstore_real. Runs in PG
+ * context.
+ */
+typedef struct pllua_to_hstore_args
+{
+	int32		pcount;
+	Pairs	   *pairs;
+	hstore_pllua_view *view;
+	HStore	   *out;
+} pllua_to_hstore_args;
+
+/*
+ * Fill in the args from the two results of pllua_to_hstore_real on the stack
+ * top. A count of -1 means the second result is an unmodified view rather
+ * than a Pairs array. Doesn't allocate, so can be called in either context.
+ */
+static void
+pllua_to_hstore_getargs(lua_State *L, pllua_to_hstore_args *args)
+{
+	args->pcount = lua_tointeger(L, -2);
+	args->pairs = NULL;
+	args->view = NULL;
+	if (args->pcount < 0)
+		args->view = lua_touserdata(L, -1);
+	else
+		args->pairs = lua_touserdata(L, -1);
+}
+
+static void
+pllua_to_hstore_build(void *arg)
+{
+	pllua_to_hstore_args *args = arg;
+	Pairs	   *pairs = args->pairs;
+	int32		pcount = args->pcount;
+	int			i;
+	int32		buflen;
+
+	args->out = NULL;
+
+	if (args->view)
+	{
+		hstore_pllua_view *v = args->view;
+
+		args->out = palloc(v->len);
+		memcpy(args->out, HSV_HSTORE(v), v->len);
+		return;
+	}
+
+	if (!pairs)
+		return;
+
+	for (i = 0; i < pcount; ++i)
+	{
+		pairs[i].keylen = hstoreCheckKeyLen(pairs[i].keylen);
+		pairs[i].vallen = hstoreCheckKeyLen(pairs[i].vallen);
+		pg_verifymbstr(pairs[i].key, pairs[i].keylen, false);
+		pg_verifymbstr(pairs[i].val, pairs[i].vallen, false);
+	}
+	pcount = hstoreUniquePairs(pairs, pcount, &buflen);
+	args->out = hstorePairs(pairs, pcount, buflen);
+}
+
+static void
+hstore_to_pllua_upgrade(void *arg)
+{
+	Datum	   *d = arg;
+
+	*d = PointerGetDatum(hstoreUpgrade(*d));
+}
+
+/*
+ * Direct callbacks registered with pllua; these are called in Lua context and
+ * do the same work as the fmgr entry points below without the round trip.
+ */
+static int
+hstore_to_pllua_direct(lua_State *L, Datum val)
+{
+	pllua_call_pg(L, hstore_to_pllua_upgrade, &val);
+	hstore_to_pllua_value(L, (HStore *) DatumGetPointer(val));
+	return 1;
+}
+
+static bool
+pllua_to_hstore_direct(lua_State *L, int nargs, int argbase,
+					   Datum *result, bool *isnull)
+{
+	pllua_to_hstore_args args;
+	int			i;
+
+	luaL_checkstack(L, 10 + nargs, NULL);
+	lua_pushcfunction(L, pllua_to_hstore_real);
+	for (i = 0; i < nargs; ++i)
+		lua_pushvalue(L, argbase + i);
+	lua_call(L, nargs, 2);
+
+	/* see comment in pllua_to_hstore */
+	pllua_to_hstore_getargs(L, &args);
+	pllua_call_pg(L, pllua_to_hstore_build, &args);
+
+	lua_pop(L, 2);
+
+	/* as with a null return from the fmgr function, this means decline */
+	if (!args.out)
+		return false;
+
+	*result = PointerGetDatum(args.out);
+	*isnull = false;
+	return true;
+}
+
 
 Datum
 hstore_to_pllua(PG_FUNCTION_ARGS)
@@ -220,16 +577,12 @@ hstore_to_pllua(PG_FUNCTION_ARGS)
 }
 
 
-PG_FUNCTION_INFO_V1(pllua_to_hstore);
-
 Datum
 pllua_to_hstore(PG_FUNCTION_ARGS)
 {
 	pllua_node *node = (pllua_node *) fcinfo->context;
 	lua_State  *L;
-	int32		pcount = 0;
-	HStore	   *out = NULL;
-	Pairs	   *pairs;
+	pllua_to_hstore_args args;
 
 	if (!node || node->type != T_Invalid || node->magic != PLLUA_MAGIC)
 		elog(ERROR, "pllua_to_hstore must only be called from pllua");
@@ -247,28 +600,14 @@ pllua_to_hstore(PG_FUNCTION_ARGS)
 	 * them being GC'd. hstorePairs will copy everything into a new palloc'd
 	 * value, and the storage will be GC'd sometime later after we pop it.
 	 */
-	pcount = lua_tointeger(L, -2);
-	pairs = lua_touserdata(L, -1);
+	pllua_to_hstore_getargs(L, &args);
 
-	if (pairs)
-	{
-		int i;
-		int32 buflen;
-		for (i = 0; i < pcount; ++i)
-		{
-			pairs[i].keylen = hstoreCheckKeyLen(pairs[i].keylen);
-			pairs[i].vallen = hstoreCheckKeyLen(pairs[i].vallen);
-			pg_verifymbstr(pairs[i].key, pairs[i].keylen, false);
-			pg_verifymbstr(pairs[i].val, pairs[i].vallen, false);
-		}
-		pcount = hstoreUniquePairs(pairs, pcount, &buflen);
-		out = hstorePairs(pairs, pcount, buflen);
-	}
+	pllua_to_hstore_build(&args);
 
 	lua_pop(L, 2);
 
-	if (out)
-		PG_RETURN_POINTER(out);
+	if (args.out)
+		PG_RETURN_POINTER(args.out);
 	else
 		PG_RETURN_NULL();
 }
@@ -36,4 +36,24 @@ do language pllua $$
   print(pgtype.hstore(function() end))
 $$;
 
+-- lazy views
+
+set hstore_pllua.lazy = on;
+
+do language pllua $$
+  local hs = pgtype.hstore('"foo"=>"bar", "baz"=>"quux", "a"=>NULL')
+  local v = (spi.execute([[select $1 as hs]], hs))[1].hs
+  print(type(v), v.foo, v.baz, v.a, v.nosuch)
+  print(pgtype.hstore(v))
+  v.foo = 'changed'
+  v.baz = nil
+  local ks = {}
+  for k,x in pairs(v) do ks[1+#ks] = k end
+  table.sort(ks)
+  print(table.concat(ks, ','), v.foo)
+  print(pgtype.hstore(v))
+$$;
+
+reset hstore_pllua.lazy;
+
 --end
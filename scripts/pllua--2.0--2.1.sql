@@ -0,0 +1,7 @@
+\echo Use "ALTER EXTENSION pllua UPDATE TO '2.1'" to load this file. \quit
+
+CREATE FUNCTION pllua_warmup(regprocedure[])
+  RETURNS integer AS 'MODULE_PATHNAME', 'pllua_warmup_functions'
+  LANGUAGE C STRICT;
+
+--end
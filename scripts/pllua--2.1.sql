@@ -17,4 +17,8 @@ CREATE TRUSTED LANGUAGE pllua
   INLINE pllua_inline_handler
   VALIDATOR pllua_validator;
 
+CREATE FUNCTION pllua_warmup(regprocedure[])
+  RETURNS integer AS 'MODULE_PATHNAME', 'pllua_warmup_functions'
+  LANGUAGE C STRICT;
+
 --
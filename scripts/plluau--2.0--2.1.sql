@@ -0,0 +1,8 @@
+\echo Use "ALTER EXTENSION plluau UPDATE TO '2.1'" to load this file. \quit
+
+CREATE FUNCTION plluau_warmup(regprocedure[])
+  RETURNS integer AS 'MODULE_PATHNAME', 'plluau_warmup_functions'
+  LANGUAGE C STRICT;
+REVOKE ALL ON FUNCTION plluau_warmup(regprocedure[]) FROM PUBLIC;
+
+--end
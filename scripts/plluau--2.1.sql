@@ -17,4 +17,9 @@ CREATE LANGUAGE plluau
   INLINE plluau_inline_handler
   VALIDATOR plluau_validator;
 
+CREATE FUNCTION plluau_warmup(regprocedure[])
+  RETURNS integer AS 'MODULE_PATHNAME', 'plluau_warmup_functions'
+  LANGUAGE C STRICT;
+REVOKE ALL ON FUNCTION plluau_warmup(regprocedure[]) FROM PUBLIC;
+
 --
@@ -107,4 +107,105 @@ do language pllua $$
   print(j_out)
 $$;
 
+-- lazy proxies
+
+do language pllua $$
+  local jsonb = require 'pllua.jsonb'
+  s = spi.prepare([[ select a from jt3 where id = $1 ]])
+  for i = 1,5 do
+    local r = (s:execute(i))[1]
+    local a = jsonb.proxy(r.a)
+    print(#a,a[#a],a[1])
+  end
+$$;
+
+do language pllua $$
+  local jsonb = require 'pllua.jsonb'
+  local j = pgtype.jsonb('{"foo":[1,null,false,{"a":null,"b":[]},{},[]],"bar":{"baz":"x","n":1.5}}')
+  local p = jsonb.proxy(j)
+  print(p.bar.baz, p.bar.n, p.foo[1], p.foo[2], p.foo[3], p.nosuch, p.foo[7])
+  print(#p, #p.foo, jsonb.is_object(p), jsonb.is_array(p.foo), jsonb.is_object(p.foo[4]))
+  print(p.foo[4], p.foo[4].a, #p.foo[4].b)
+  for k,v in pairs(p) do print(k, v) end
+  for i,v in pairs(p.foo) do print(i, v) end
+  local nvl = {}
+  local q = jsonb.proxy(j, { null = nvl, pg_numeric = true })
+  print(q.foo[2] == nvl, type(p.bar.n), type(q.bar.n), q.bar.n)
+  print(pgtype.jsonb({ x = p.bar, y = p.foo[4] }))
+  print(pgtype.jsonb(p.foo))
+  print(jsonb.proxy(pgtype.jsonb('"scalar"')), jsonb.proxy(pgtype.jsonb('42')))
+$$;
+
+-- streaming events
+
+do language pllua $$
+  local j = pgtype.jsonb('{"a":[1,{"b":null}],"cd":"x"}')
+  for tok, k, v in j:events() do print(tok, k, v) end
+  for tok, k, v in pgtype.jsonb('5'):events() do print(tok, k, v) end
+  local nvl = {}
+  for tok, k, v in pgtype.jsonb('[null]'):events{ null = nvl } do print(tok, k, v == nvl) end
+  local arr = spi.execute([[select jsonb_agg(jsonb_build_object('n', i, 'f', i*2)) as j
+                              from generate_series(1,1000) i]])[1].j
+  local sum = 0
+  for tok, k, v in arr:events() do
+    if tok == "value" and k == "f" then sum = sum + v end
+  end
+  print(sum)
+$$;
+
+-- trusted-shape construction
+
+do language pllua $$
+  local jsonb = require 'pllua.jsonb'
+  local t = { a = { 1, 2, nil, 4 },
+              b = jsonb.set_as_array({}),
+              c = {},
+              d = jsonb.set_as_object({}),
+              e = { y = "z", [5] = true } }
+  print(pgtype.jsonb(t, { trusted_shape = true }))
+  print(pgtype.jsonb(t, { trusted_shape = true, empty_object = true }))
+  print(pgtype.jsonb({ 1, "foo", { x = false } },
+                     { trusted_shape = true,
+                       map = function(v) if v == "foo" then return "bar" end return v end }))
+$$;
+
+-- json text conversion
+
+do language pllua $$
+  local json = require 'pllua.json'
+  local jsonb = require 'pllua.jsonb'
+  local v = json.decode(' {"a":[1,2.5,null,"x\\u0041\\n"],"b":{"c":true,"d":false},"e":[],"f":{}} ')
+  print(jsonb.is_object(v), jsonb.is_array(v.a), v.a[2], v.a[3], v.a[4] == "xA\n", v.b.c, #v.e)
+  print(json.encode(v, { sort_keys = true }))
+  local nvl = {}
+  local w = json.decode('[1,null,{"k":null}]', { null = nvl, pg_numeric = true })
+  print(w[2] == nvl, w[3].k == nvl, type(w[1]), w[1])
+  print(json.encode(w, { null = nvl }))
+  print(json.encode({ 1, 2, 3 }), json.encode({}), json.encode({}, { empty_object = true }),
+        json.encode('a"b'), json.encode(nil))
+  print(json.encode({ n = pgtype.numeric('1.50'),
+                      j = pgtype.jsonb('{"x": [1]}'),
+                      p = pgtype.point('(1,2)') },
+                    { sort_keys = true }))
+  local d = json.todatum({ k = { true } })
+  print(pgtype(d) == pgtype.json, d)
+  print(pcall(json.decode, '[1,]'))
+  print(pcall(json.decode, '{"a":1} x'))
+$$;
+
+do language pllua $$
+  local json = require 'pllua.json'
+  print(pcall(json.encode, { math.huge }))
+  print(json.encode({ 0.1 + 0.2, 0.5, -1e300 }))
+  print(pcall(json.encode, { pgtype.numeric('NaN') }))
+  print(pcall(json.todatum, { n = pgtype.numeric('NaN') }))
+  -- values of json-ish types are copied as-is; the result must still parse
+  local d = json.todatum({ n = pgtype.numeric('-0.5'),
+                           j = pgtype.json('{"a" : [1, "x"]}'),
+                           b = pgtype.jsonb('[true]') },
+                         { sort_keys = true })
+  print(d)
+  print(pgtype.jsonb(tostring(d)))
+$$;
+
 --end
@@ -0,0 +1,49 @@
+--
+
+\set VERBOSITY terse
+
+--
+
+-- precompiled jsonpath (pg12+)
+
+do language pllua $$
+  local jsonb = require 'pllua.jsonb'
+  local doc = pgtype.jsonb('{"items":[{"name":"a","price":5},{"name":"b","price":15},{"name":"c","price":25}]}')
+  local p = jsonb.path('$.items[*] ? (@.price > $min)')
+  print(p)
+  for item in p:query(doc, { min = 10 }) do print(item) end
+  for item in p:query(doc, pgtype.jsonb('{"min": 20}')) do print(item) end
+  local n = 0
+  for item in p:query(doc, { min = 100 }) do n = n + 1 end
+  print(n)
+  print(p:exists(doc, { min = 20 }), p:exists(doc, { min = 30 }))
+  -- reuse with a different document
+  local doc2 = pgtype.jsonb('{"items":[{"name":"d","price":50}]}')
+  for item in p:query(doc2, { min = 10 }) do print(item) end
+  local names = jsonb.path('$.items[*].name')
+  for v in names:query(doc) do print(v) end
+$$;
+
+-- errors and silent mode
+
+do language pllua $$
+  local jsonb = require 'pllua.jsonb'
+  local doc = pgtype.jsonb('{"a": 1}')
+  local strict = jsonb.path('strict $.missing')
+  local r, e = pcall(function() return strict:exists(doc) end)
+  print(r, e.sqlstate)
+  r, e = pcall(function() for v in strict:query(doc) do end end)
+  print(r, e.sqlstate)
+  print(strict:exists(doc, nil, true))
+  local n = 0
+  for v in strict:query(doc, nil, true) do n = n + 1 end
+  print(n)
+  local lax = jsonb.path('$.missing')
+  print(lax:exists(doc))
+  r, e = pcall(jsonb.path, '$.[bad')
+  print(r, e.sqlstate)
+  r, e = pcall(function() return jsonb.path('$.a ? (@ > $x)'):exists(doc) end)
+  print(r, e.sqlstate)
+$$;
+
+--end
@@ -0,0 +1,70 @@
+--
+
+\set VERBOSITY terse
+
+--
+
+-- memory limit; applies to the already-existing interpreter
+
+do language pllua $$ print("interpreter exists") $$;
+
+set pllua.max_interpreter_memory = '32MB';
+
+do language pllua $$
+  print(pcall(function() return #string.rep("x", 64*1024*1024) end))
+  local t = {}
+  for i = 1,1000 do t[i] = tostring(i) end
+  print(#t)
+$$;
+
+do language pllua $$
+  local s = string.rep("x", 64*1024*1024)
+  print(#s)
+$$;
+
+-- datum memory held by the interpreter counts too
+
+do language pllua $$
+  local r = pcall(function()
+    local d = spi.execute([[ select repeat('x', 40*1024*1024)::bytea as b ]])[1].b
+    local t = {}
+    for i = 1,100000 do t[i] = tostring(i) end
+    return #t
+  end)
+  -- emergency collections don't run finalizers, so free the datum now
+  collectgarbage()
+  -- there's no limit with lua 5.1 or luajit, and datum memory can't be
+  -- measured on pg 9.5; otherwise the pcall must have failed
+  local s = pgtype.memory_stats()
+  local limited = s.allocator ~= "builtin" and s.context_bytes > 0
+  print(limited == not r)
+$$;
+
+reset pllua.max_interpreter_memory;
+
+do language pllua $$
+  local s = string.rep("x", 64*1024*1024)
+  print(#s)
+$$;
+
+-- context allocator smoke test; needs a fresh interpreter
+
+\c
+set pllua.context_allocator = on;
+
+do language pllua $$
+  local s = pgtype.memory_stats()
+  print(s.allocator, s.lua_bytes > 0, type(s.lua_blocks), type(s.context_bytes))
+  local t = {}
+  for i = 1,10000 do t[i] = tostring(i) end
+  local s2 = pgtype.memory_stats()
+  print(s2.lua_bytes > s.lua_bytes)
+  t = nil
+  collectgarbage()
+  print(pgtype.memory_stats().lua_bytes < s2.lua_bytes)
+  print(spi.execute([[ select count(*) as n from generate_series(1,1000) ]])[1].n)
+$$;
+
+reset pllua.context_allocator;
+
+--end
@@ -90,6 +90,35 @@ do language pllua $$
   print(pi())
 $$;
 
+-- accumulators
+
+do language pllua $$
+  local num = require 'pllua.numeric'
+  local a = num.accumulator()
+  for i = 1,100 do a:add(i) end
+  print(a:result())
+  local b = num.accumulator(1)
+  for i = 1,25 do b:mul(i) end
+  print(b:result())
+  for i = 26,40 do b:mul(i) end
+  print(b:result())
+  local c = num.accumulator('0.10')
+  c:add(0.25):sub(num.new('0.05')):add(2)
+  print(c:result())
+$$;
+
+-- integer arithmetic
+
+do language pllua $$
+  local num = require 'pllua.numeric'
+  local imax = num.new('9223372036854775807')
+  print(imax + 1, -imax - 2, imax - imax)
+  print(num.new('3037000500') * num.new('3037000500'), num.new(10000) * 10000)
+  print(num.new('1.0') + 1, num.new(0) * -5, num.new('-123456789') * 1000)
+  print(num.new(-12) < 5, num.new(100000000) == num.new('100000000'), num.new('5.5') <= 5)
+  print(num.tointeger(num.new('-12345678901234')), num.tointeger(imax + 1))
+$$;
+
 -- check sanity of maxinteger/mininteger
 
 do language pllua $$
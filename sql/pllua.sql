@@ -181,4 +181,54 @@ do language pllua $$
   print((lpcall(require,"io")))
 $$;
 
+-- warmup
+create function pllua_wu1(a integer) returns integer language pllua
+  as $$ return a + 1 $$;
+create function pllua_wu2(t text) returns text language pllua
+  as $$ return t .. "!" $$;
+select pllua_warmup(array['pllua_wu1(integer)','pllua_wu2(text)']::regprocedure[]);
+select pllua_warmup(array['pllua_wu1(integer)',null]::regprocedure[]);
+select pllua_wu1(1), pllua_wu2('x');
+select pllua_warmup(array['lower(text)']::regprocedure[]);
+
+-- inline cache: repeated DO blocks get fresh globals each time
+do language pllua $$ x = (x or 0) + 1 print(x) $$;
+do language pllua $$ x = (x or 0) + 1 print(x) $$;
+set pllua.inline_cache_size = 1;
+do language pllua $$ y = (y or 0) + 1 print("y",y) $$;
+do language pllua $$ x = (x or 0) + 1 print(x) $$;
+do language pllua $$ y = (y or 0) + 1 print("y",y) $$;
+reset pllua.inline_cache_size;
+
+-- bytecode cache
+set pllua.bytecode_cache = on;
+create function pllua_bc1(a integer) returns integer language plluau
+  as $$ return a * 2 $$;
+select pllua_bc1(21);
+select count(*) from pg_ls_dir('pllua_cache') f
+ where split_part(f, '_', 1) = (select oid::text from pg_database
+                                 where datname = current_database())
+   and split_part(f, '_', 2) = 'pllua_bc1(integer)'::regprocedure::oid::text;
+\c
+set pllua.bytecode_cache = on;
+select pllua_bc1(21);
+create or replace function pllua_bc1(a integer) returns integer language plluau
+  as $$ return a * 3 $$;
+select pllua_bc1(21);
+\c
+set pllua.bytecode_cache = on;
+select pllua_bc1(21);
+select count(*) from pg_ls_dir('pllua_cache') f
+ where split_part(f, '_', 1) = (select oid::text from pg_database
+                                 where datname = current_database())
+   and split_part(f, '_', 2) = 'pllua_bc1(integer)'::regprocedure::oid::text;
+create function pllua_bc2(a integer) returns integer language pllua
+  as $$ return a * 2 $$;
+select pllua_bc2(21);
+select count(*) from pg_ls_dir('pllua_cache') f
+ where split_part(f, '_', 1) = (select oid::text from pg_database
+                                 where datname = current_database())
+   and split_part(f, '_', 2) = 'pllua_bc2(integer)'::regprocedure::oid::text;
+reset pllua.bytecode_cache;
+
 --end
@@ -205,4 +205,20 @@ do language pllua $$ collectgarbage() $$;  -- check cursor stays open
 fetch all from mycur2;
 commit;
 
+-- error-tolerant batch execution
+
+create temp table batchtab (id integer primary key, val text not null);
+
+do language pllua $$
+  local s = spi.prepare([[ insert into batchtab values ($1, $2) ]], {"integer","text"})
+  local rows = {}
+  for i = 1,10 do rows[i] = { i, "v"..i } end
+  rows[4] = { 3, "dup" }
+  rows[8] = { 8, nil }
+  local rejects, n = s:execute_batch(rows, { chunk = 3 })
+  print(n, #rejects)
+  for _,r in ipairs(rejects) do print(r.row, r.sqlstate) end
+$$;
+select count(*), sum(id) from batchtab;
+
 --end
@@ -145,4 +145,72 @@ do language pllua $$
   print(err.type(e), err.category(e), err.errcode(e), e)
 $$;
 
+-- pcall subtransactions are only started when pg is entered
+
+truncate table xatst;
+
+do language pllua $$
+  local stmt = spi.prepare([[ insert into xatst values ($1) ]]);
+  stmt:execute(1);
+  print(pcall(function(a,b) return a+b, "pure" end, 1, 2))
+  print(pcall(function() error("pure lua error") end))
+  print(pcall(function()
+    print("inner", pcall(function() stmt:execute(2) end))
+    return "outer"
+  end))
+  stmt:execute(3);
+$$;
+
+-- row 2 must have its own xid from the (nested) subtransactions, while
+-- row 3 must not have been caught by a leftover pending one
+select a, xmin = (select xmin from xatst where a = 1) as toplevel
+  from xatst order by a;
+
+truncate table xatst;
+
+do language pllua $$
+  local stmt = spi.prepare([[ insert into xatst values ($1) ]]);
+  stmt:execute(1);
+  local r,e = pcall(function() spi.execute([[ select 1/0 ]]) end)
+  print(r, e.sqlstate)
+  r,e = pcall(function() stmt:execute(2) spi.execute([[ select 1/0 ]]) end)
+  print(r, e.sqlstate)
+  stmt:execute(3);
+$$;
+
+-- should now be rows 1 and 3 only
+select a from xatst order by a;
+
+truncate table xatst;
+
+do language pllua $$
+  local stmt = spi.prepare([[ insert into xatst values ($1) ]]);
+  stmt:execute(1);
+  -- outer pcall body is pure lua apart from the inner pcall
+  print(pcall(function()
+    local t = {}
+    for i = 1,10 do t[i] = i end
+    print("inner", pcall(function() stmt:execute(2) error("inner") end))
+    print("inner", pcall(function() stmt:execute(3) end))
+    error("outer")
+  end))
+  print(pcall(function()
+    print("inner", pcall(function() stmt:execute(4) end))
+    return #"outer"
+  end))
+  stmt:execute(5);
+$$;
+
+-- should now be rows 1, 4 and 5
+select a from xatst order by a;
+
+-- a cancel arriving while the subxact is still pending can't be caught
+
+set statement_timeout = '500ms';
+do language pllua $$
+  print(pcall(function() while true do end end))
+  print("should not be reached")
+$$;
+reset statement_timeout;
+
 --end
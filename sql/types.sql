@@ -202,4 +202,120 @@ do language pllua $$
   print(pgtype.ctype3(1,2))
 $$;
 
+-- native sort
+
+do language pllua $$
+  local n = pgtype.numeric
+  local t = pgtype.sort({ n(3), 10.5, '2.25', n(-1) }, n)
+  local r = {} for i,v in ipairs(t) do r[i] = tostring(v) end
+  print(table.concat(r, ' '))
+$$;
+
+do language pllua $$
+  local c = pgtype.ctype3
+  local t = pgtype.sort({ c(1,5), c(2,nil), c(3,7), c(4,5) }, 'numeric',
+                        { key = 'jim', desc = true })
+  local r = {} for i,v in ipairs(t) do r[i] = v.fred end
+  print(table.concat(r, ' '))
+$$;
+
+do language pllua $$
+  local t = pgtype.sort({ 'b', 'B', 'a', 'A' }, pgtype.text,
+                        { collation = 'C' })
+  print(table.concat(t, ' '))
+$$;
+
+do language pllua $$
+  local t = pgtype.sort({ '(1,2)', '(0,0)' }, pgtype.point)  -- error
+$$;
+
+-- datum hashmaps
+
+do language pllua $$
+  local hashmap = require 'pllua.hashmap'
+  local m = hashmap.new(pgtype.numeric)
+  m:set(1, 'a'):set(pgtype.numeric('1.0'), 'b'):set('2', 'c')
+  print(#m, m:get(1), m:get(pgtype.numeric(2)), m:get(3))
+$$;
+
+do language pllua $$
+  local hashmap = require 'pllua.hashmap'
+  local m = hashmap.new('text')
+  m:build(spi.execute([[select * from (values ('a',1),('b',2),(null,3)) v(k,n)]]),
+          'k', 'n')
+  local r = {}
+  for row, n in m:probe(spi.execute([[select * from (values ('b'),('c'),('a'),('b')) v(k)]]), 'k') do
+    r[#r+1] = row.k .. n
+  end
+  print(#m, table.concat(r, ' '))
+  m:set('a', nil)
+  print(#m, m:get('a'), m:get('b'))
+  -- null values are skipped, not stored as present keys or deletes
+  m:build(spi.execute([[select * from (values ('c',null::integer),('b',null)) v(k,n)]]),
+          'k', 'n')
+  print(#m, m:get('b'), m:get('c'))
+$$;
+
+-- native conversion of temporal and uuid types
+
+set pllua.native_types = on;
+
+do language pllua $$
+  local r = spi.execute([[select timestamptz '2020-01-01 00:00:00+00' as tz,
+                                 timestamp '2020-01-01 12:00:00' as ts,
+                                 date '2020-01-02' as d,
+                                 interval '1 mon 2 days 03:00:00.5' as i,
+                                 uuid 'a0eebc99-9c0b-4ef8-bb6d-6bb9bd380a11' as u]])[1]
+  print(string.format("%.1f %.1f %.1f", r.tz, r.ts, r.d))
+  print(r.i.months, r.i.days, r.i.usecs, #r.u)
+  local q = spi.execute([[select to_char($1, 'YYYY-MM-DD HH24:MI:SS') as ts,
+                                 to_char($2, 'YYYY-MM-DD') as d,
+                                 $3 = interval '1 mon 2 days 03:00:00.5' as i,
+                                 $4 = uuid 'a0eebc99-9c0b-4ef8-bb6d-6bb9bd380a11' as u]],
+                        pgtype.timestamp(r.ts), pgtype.date(r.d),
+                        pgtype.interval(r.i), pgtype.uuid(r.u))[1]
+  print(q.ts, q.d, q.i, q.u)
+$$;
+
+reset pllua.native_types;
+
+-- temporal arithmetic
+
+do language pllua $$
+  local function f(v) return string.format("%g", v) end
+  local ts = pgtype.timestamp('2020-01-31 10:30:00')
+  local d = pgtype.date('2020-03-01')
+  print(f((ts + '1 day'):extract('day')), f((ts + pgtype.interval('1 mon')):extract('month')))
+  print(d - pgtype.date('2020-02-01'), f((d + 1):extract('day')), f((d - 1):extract('day')))
+  print(ts < ts + '1 second', ts == pgtype.timestamp('2020-01-31 10:30:00'), ts <= ts - '1 hour')
+  print(f((ts - pgtype.timestamp('2020-01-30 09:00:00')):extract('epoch')))
+  print(f(ts:date_trunc('hour'):extract('minute')), f((pgtype.interval('3 days') * 2):extract('day')))
+  print(f(d:age(pgtype.date('2019-01-01')):extract('year')), ts == d)
+$$;
+
+-- function handles
+
+do language pllua $$
+  local lower = pgtype.func('pg_catalog.lower(text)')
+  local pl = pgtype.func('int4pl(integer,integer)')
+  print(lower('ABC'), lower(nil), pl(1, 2), pl(pgtype.int4(40), '2'))
+  local n = 0
+  for i = 1,1000 do n = pl(n, i) end
+  print(n, tostring(pl))
+  print(pcall(pl, 1))
+  print(pcall(pgtype.func, 'generate_series(integer,integer)'))
+$$;
+
+-- operator handles
+
+do language pllua $$
+  local f = function(v) return string.format("%g", v) end
+  local dist = pgtype.op('<->', 'point', pgtype.point)
+  local overlaps = pgtype.op('&&', 'int4range', 'int4range')
+  local contains = pgtype.op('pg_catalog.@>', 'int4range', 'integer')
+  local neg = pgtype.op('-', nil, 'integer')
+  print(f(dist('(0,0)', '(3,4)')), overlaps('[1,5)', '[3,8)'), overlaps('[1,3)', '[3,8)'))
+  print(contains('[1,5)', 3), contains('[1,5)', 5), neg(5), tostring(neg))
+$$;
+
 --end
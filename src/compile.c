@@ -1,15 +1,37 @@
 
 #include "pllua.h"
 
+#include "access/genam.h"
+#include "access/hash.h"
 #include "access/htup_details.h"
+#if PG_VERSION_NUM >= 120000
+#include "access/table.h"
+#else
+#include "access/heapam.h"
+#endif
+#include "catalog/namespace.h"
 #include "catalog/pg_proc.h"
 #include "catalog/pg_language.h"
 #include "catalog/pg_type.h"
 #include "utils/builtins.h"
+#include "utils/fmgroids.h"
 #include "utils/guc.h"
+#if PG_VERSION_NUM >= 110000
+#include "utils/regproc.h"
+#endif
 #include "utils/syscache.h"
 #include "utils/lsyscache.h"
 
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Directory (relative to the data directory, which is our cwd) used for the
+ * bytecode cache.
+ */
+#define PLLUA_BYTECODE_CACHE_DIR "pllua_cache"
+
 
 /*
  * Do fairly minimalist validation on the procTup to ensure that we're not
@@ -62,6 +84,303 @@ pllua_prepare_function(lua_State *L, bool trusted)
 	pllua_set_environment(L, -3);
 }
 
+/*
+ * Bytecode cache.
+ *
+ * If pllua.bytecode_cache is on, the compiled chunk for each function is
+ * dumped to a file in the data directory, and other sessions load that
+ * instead of parsing the source. The file name includes the database and
+ * function oids, the xmin of the pg_proc row, and a hash of the complete
+ * generated source, so any change to the function (or to how we wrap it)
+ * results in a new name rather than a stale hit. Storing a new entry removes
+ * any others for the same function; entries for dropped functions stay until
+ * someone empties the directory, which is safe to do at any time.
+ *
+ * Loading a binary chunk bypasses everything the sandbox relies on, and the
+ * directory can be written by anyone who can write server files (e.g. via
+ * COPY), so the cache is used only for untrusted functions. A file that fails
+ * to load (from a different Lua version, say) is just ignored and rewritten.
+ *
+ * This is all done with plain stdio in lua context; any failure here just
+ * means we don't use the cache.
+ */
+static void
+pllua_bytecode_cache_path(char *buf, size_t len,
+						  pllua_function_info *func_info,
+						  const char *src, size_t srclen)
+{
+	uint32		hash = DatumGetUInt32(hash_any((const unsigned char *) src,
+											   (int) srclen));
+
+	snprintf(buf, len, PLLUA_BYTECODE_CACHE_DIR "/%u_%u_%u_%08x.luac",
+			 MyDatabaseId, func_info->fn_oid, func_info->fn_xmin, hash);
+}
+
+/*
+ * Try to load the function from the cache; returns true with the chunk on
+ * the stack if successful.
+ */
+static bool
+pllua_bytecode_cache_load(lua_State *L, const char *path, const char *fname)
+{
+	struct stat st;
+	FILE	   *f;
+	void	   *buf;
+	bool		ok;
+
+	if (stat(path, &st) != 0 || st.st_size <= 0)
+		return false;
+
+	buf = lua_newuserdata(L, st.st_size);
+	f = fopen(path, PG_BINARY_R);
+	if (!f)
+	{
+		lua_pop(L, 1);
+		return false;
+	}
+	ok = (fread(buf, 1, st.st_size, f) == (size_t) st.st_size);
+	fclose(f);
+
+	if (ok && luaL_loadbufferx(L, buf, st.st_size, fname, "b") == LUA_OK)
+	{
+		lua_remove(L, -2);
+		return true;
+	}
+
+	lua_pop(L, ok ? 2 : 1);
+	return false;
+}
+
+/*
+ * The buffer is initialized on first write, since in 5.4 luaL_buffinit
+ * pushes a stack entry and lua_dump wants the function at the top.
+ */
+typedef struct pllua_bytecode_dump
+{
+	bool		init;
+	luaL_Buffer b;
+} pllua_bytecode_dump;
+
+static int
+pllua_bytecode_writer(lua_State *L, const void *p, size_t sz, void *ud)
+{
+	pllua_bytecode_dump *dump = ud;
+
+	if (!dump->init)
+	{
+		dump->init = true;
+		luaL_buffinit(L, &dump->b);
+	}
+	luaL_addlstring(&dump->b, p, sz);
+	return 0;
+}
+
+/*
+ * Remove all cache entries for the function other than the one at path.
+ */
+static void
+pllua_bytecode_cache_prune(pllua_function_info *func_info, const char *path)
+{
+	const char *keep = path + strlen(PLLUA_BYTECODE_CACHE_DIR "/");
+	char		prefix[32];
+	char		oldpath[MAXPGPATH];
+	size_t		prefixlen;
+	DIR		   *dir;
+	struct dirent *de;
+
+	prefixlen = snprintf(prefix, sizeof(prefix), "%u_%u_",
+						 MyDatabaseId, func_info->fn_oid);
+
+	dir = opendir(PLLUA_BYTECODE_CACHE_DIR);
+	if (!dir)
+		return;
+	while ((de = readdir(dir)) != NULL)
+	{
+		size_t		namelen = strlen(de->d_name);
+
+		if (strncmp(de->d_name, prefix, prefixlen) != 0
+			|| namelen < sizeof(".luac")
+			|| strcmp(de->d_name + namelen - strlen(".luac"), ".luac") != 0
+			|| strcmp(de->d_name, keep) == 0)
+			continue;
+		snprintf(oldpath, sizeof(oldpath), PLLUA_BYTECODE_CACHE_DIR "/%s",
+				 de->d_name);
+		unlink(oldpath);
+	}
+	closedir(dir);
+}
+
+/*
+ * Store the chunk on the stack top (which is left in place) in the cache. We
+ * write to a temp file and rename it, so other sessions never see a partial
+ * file.
+ */
+static void
+pllua_bytecode_cache_store(lua_State *L, pllua_function_info *func_info,
+						   const char *path)
+{
+	int			base = lua_gettop(L);
+	char		tmppath[MAXPGPATH];
+	pllua_bytecode_dump dump;
+	const char *data;
+	size_t		len;
+	FILE	   *f;
+	bool		ok;
+
+	dump.init = false;
+	lua_pushvalue(L, -1);
+	if (pllua_dump(L, pllua_bytecode_writer, &dump) != 0 || !dump.init)
+	{
+		lua_settop(L, base);
+		return;
+	}
+	luaL_pushresult(&dump.b);
+	data = lua_tolstring(L, -1, &len);
+
+	snprintf(tmppath, sizeof(tmppath), "%s.%d.tmp", path, MyProcPid);
+	f = fopen(tmppath, PG_BINARY_W);
+	if (!f && errno == ENOENT)
+	{
+		(void) mkdir(PLLUA_BYTECODE_CACHE_DIR, S_IRWXU);
+		f = fopen(tmppath, PG_BINARY_W);
+	}
+	if (f)
+	{
+		ok = (fwrite(data, 1, len, f) == len);
+		if (fclose(f) != 0)
+			ok = false;
+		if (!ok || rename(tmppath, path) != 0)
+			unlink(tmppath);
+	}
+	lua_settop(L, base);
+}
+
+/*
+ * Inline cache.
+ *
+ * Scripts that run the same DO block over and over would otherwise parse it
+ * from scratch each time. We keep the dumped bytecode of recently used blocks,
+ * keyed by the source text itself, and reload from that instead; we can't
+ * keep the compiled closure because each execution must get a fresh
+ * environment table, and the environment is an upvalue of the closure.
+ *
+ * The table is per interpreter, so the trust mode is implicitly part of the
+ * key. The size is bounded by pllua.inline_cache_size; when full, the least
+ * recently used entry is dropped. The stamps come from a counter shared by
+ * all interpreters, which is fine since only their order matters.
+ */
+static lua_Integer pllua_inline_cache_clock = 0;
+
+static void
+pllua_inline_cache_get_table(lua_State *L)
+{
+	if (lua_rawgetp(L, LUA_REGISTRYINDEX, PLLUA_INLINE_CACHE) != LUA_TTABLE)
+	{
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lua_pushvalue(L, -1);
+		lua_rawsetp(L, LUA_REGISTRYINDEX, PLLUA_INLINE_CACHE);
+	}
+}
+
+/*
+ * Try to load the block from the cache; returns true with the chunk on the
+ * stack if successful.
+ */
+static bool
+pllua_inline_cache_load(lua_State *L, const char *str, size_t len)
+{
+	int			base = lua_gettop(L);
+	const char *bc;
+	size_t		bclen;
+
+	pllua_inline_cache_get_table(L);
+	lua_pushlstring(L, str, len);
+	if (lua_rawget(L, -2) != LUA_TTABLE)
+	{
+		lua_settop(L, base);
+		return false;
+	}
+	lua_rawgeti(L, -1, 1);
+	bc = lua_tolstring(L, -1, &bclen);
+	if (!bc || luaL_loadbufferx(L, bc, bclen, "DO-block", "b") != LUA_OK)
+	{
+		lua_settop(L, base);
+		return false;
+	}
+	/* stack: cache entry bytecode chunk */
+	lua_pushinteger(L, ++pllua_inline_cache_clock);
+	lua_rawseti(L, -4, 2);
+	lua_replace(L, base + 1);
+	lua_settop(L, base + 1);
+	return true;
+}
+
+/*
+ * Store the chunk on the stack top (which is left in place) in the cache,
+ * evicting old entries if needed.
+ */
+static void
+pllua_inline_cache_store(lua_State *L, const char *str, size_t len)
+{
+	int			base = lua_gettop(L);
+	int			cache;
+	pllua_bytecode_dump dump;
+
+	dump.init = false;
+	lua_pushvalue(L, -1);
+	if (pllua_dump(L, pllua_bytecode_writer, &dump) != 0 || !dump.init)
+	{
+		lua_settop(L, base);
+		return;
+	}
+	luaL_pushresult(&dump.b);
+	/* stack: chunk chunk bytecode */
+
+	pllua_inline_cache_get_table(L);
+	cache = lua_gettop(L);
+
+	for (;;)
+	{
+		int			n = 0;
+		lua_Integer oldest = 0;
+
+		lua_pushnil(L);			/* oldest key so far */
+		lua_pushnil(L);
+		while (lua_next(L, cache))
+		{
+			lua_Integer stamp;
+
+			lua_rawgeti(L, -1, 2);
+			stamp = lua_tointeger(L, -1);
+			lua_pop(L, 2);
+			if (n++ == 0 || stamp < oldest)
+			{
+				oldest = stamp;
+				lua_pushvalue(L, -1);
+				lua_replace(L, cache + 1);
+			}
+		}
+		if (n < pllua_inline_cache_size)
+		{
+			lua_pop(L, 1);
+			break;
+		}
+		lua_pushnil(L);
+		lua_rawset(L, cache);
+	}
+
+	lua_pushlstring(L, str, len);
+	lua_createtable(L, 2, 0);
+	lua_pushvalue(L, cache - 1);
+	lua_rawseti(L, -2, 1);
+	lua_pushinteger(L, ++pllua_inline_cache_clock);
+	lua_rawseti(L, -2, 2);
+	lua_rawset(L, cache);
+
+	lua_settop(L, base);
+}
+
 /*
  * Given the body of a DO-block, compile it. This is here mostly to centralize
  * in this file (pllua_compile_inline and pllua_compile) the environment tweaks
@@ -70,8 +389,16 @@ pllua_prepare_function(lua_State *L, bool trusted)
 void
 pllua_compile_inline(lua_State *L, const char *str, bool trusted)
 {
-	if (luaL_loadbufferx(L, str, strlen(str), "DO-block", "t"))
-		pllua_rethrow_from_lua(L, LUA_ERRRUN);
+	size_t		len = strlen(str);
+	bool		use_cache = (pllua_inline_cache_size > 0);
+
+	if (!use_cache || !pllua_inline_cache_load(L, str, len))
+	{
+		if (luaL_loadbufferx(L, str, len, "DO-block", "t"))
+			pllua_rethrow_from_lua(L, LUA_ERRRUN);
+		if (use_cache)
+			pllua_inline_cache_store(L, str, len);
+	}
 	pllua_prepare_function(L, trusted);
 }
 
@@ -93,6 +420,9 @@ pllua_compile(lua_State *L)
 	pllua_function_info *func_info = comp_info->func_info;
 	const char	   *fname = func_info->name;
 	const char	   *src;
+	size_t		srclen;
+	char		cachepath[MAXPGPATH];
+	bool		use_cache = pllua_bytecode_cache && !func_info->trusted;
 	luaL_Buffer b;
 
 	if (!comp_info->validate_only)
@@ -180,13 +510,22 @@ pllua_compile(lua_State *L)
 	luaL_addstring(&b, " end return ");
 	luaL_addstring(&b, fname);
 	luaL_pushresult(&b);
-	src = lua_tostring(L, -1);
+	src = lua_tolstring(L, -1, &srclen);
+
+	if (use_cache)
+		pllua_bytecode_cache_path(cachepath, sizeof(cachepath),
+								  func_info, src, srclen);
 
 	/*
 	 * Load the code into lua but run nothing. (Syntax errors show up here.)
 	 */
-	if (luaL_loadbufferx(L, src, strlen(src), fname, "t"))
-		pllua_rethrow_from_lua(L, LUA_ERRRUN);
+	if (!use_cache || !pllua_bytecode_cache_load(L, cachepath, fname))
+	{
+		if (luaL_loadbufferx(L, src, srclen, fname, "t"))
+			pllua_rethrow_from_lua(L, LUA_ERRRUN);
+		if (use_cache)
+			pllua_bytecode_cache_store(L, func_info, cachepath);
+	}
 	lua_remove(L, -2); /* drop source */
 
 	/*
@@ -430,6 +769,102 @@ pllua_function_valid(pllua_function_info *func_info,
 			ItemPointerEquals(&func_info->fn_tid, &procTup->t_self));
 }
 
+/*
+ * Compile up a function from scratch given its pg_proc row, and intern the
+ * result in the functions table.
+ *
+ * If act is not null, it is resolved against the new function before
+ * compiling; callers that only want the function compiled ahead of time
+ * (pllua_preload_function) pass NULL.
+ *
+ * CurrentMemoryContext is assumed transient.
+ */
+static void
+pllua_compile_and_intern(lua_State *L,
+						 Oid fn_oid,
+						 HeapTuple procTup,
+						 bool trusted,
+						 pllua_func_activation *act,
+						 FunctionCallInfo fcinfo)
+{
+	MemoryContext oldcontext = CurrentMemoryContext;
+	pllua_function_info *func_info;
+	pllua_function_compile_info *comp_info;
+	MemoryContext fcxt;
+	MemoryContext ccxt;
+	int			rc;
+
+	/*
+	 * Create the func_info, compile_info and contexts. Note that the compile
+	 * context is always transient, but the function context is reparented to
+	 * the long-lived lua context on success.
+	 */
+	fcxt = AllocSetContextCreate(CurrentMemoryContext,
+								 "pllua function object",
+								 ALLOCSET_SMALL_SIZES);
+	ccxt = AllocSetContextCreate(CurrentMemoryContext,
+								 "pllua compile context",
+								 ALLOCSET_SMALL_SIZES);
+
+	func_info = MemoryContextAlloc(fcxt, sizeof(pllua_function_info));
+	func_info->mcxt = fcxt;
+
+	comp_info = MemoryContextAlloc(ccxt, sizeof(pllua_function_compile_info));
+	comp_info->mcxt = ccxt;
+	comp_info->func_info = func_info;
+
+	pllua_load_from_proctup(L, fn_oid,
+							func_info, comp_info,
+							procTup, trusted);
+
+	/*
+	 * Resolve the activation before compiling in case the user code tries to
+	 * do something that needs access to it.
+	 */
+	if (act)
+		pllua_resolve_activation(L, act, func_info, fcinfo);
+
+	/*
+	 * Beware, compiling can invoke user-supplied code, which might in turn
+	 * recurse here. We trust that stack depth checks will break any such loop
+	 * if need be.
+	 */
+	pllua_pushcfunction(L, pllua_compile);
+	lua_pushlightuserdata(L, comp_info);
+	rc = pllua_pcall_nothrow(L, 1, 1, 0);
+
+	MemoryContextSwitchTo(oldcontext);
+	MemoryContextDelete(ccxt);
+
+	if (rc)
+	{
+		/* error. bail out */
+		if (act)
+			act->resolved = false;
+		MemoryContextDelete(fcxt);
+		pllua_rethrow_from_lua(L, rc);
+	}
+	else
+	{
+		void **p = lua_touserdata(L, -1);
+		MemoryContextSetParent(fcxt, pllua_get_memory_cxt(L));
+		*p = func_info;
+	}
+
+	/*
+	 * Try and intern the function. If the caller uninterned any previous
+	 * version, we expect this to succeed, but a recursive call could have
+	 * interned a new version already (which will be at least as new as ours).
+	 * Worse, if so, that new version could already be out of date, meaning
+	 * that pllua_validate_and_push has to loop back to check the pg_proc row
+	 * again.
+	 */
+	pllua_pushcfunction(L, pllua_intern_function);
+	lua_insert(L, -2);
+	lua_pushinteger(L, (lua_Integer) fn_oid);
+	pllua_pcall(L, 2, 0, 0);
+}
+
 /*
  * Returns with a function activation object on top of the lua stack.
  *
@@ -457,7 +892,6 @@ pllua_validate_and_push(lua_State *L,
 	{
 		pllua_func_activation *act = flinfo->fn_extra;
 		Oid		fn_oid = flinfo->fn_oid;
-		int		rc;
 
 		/*
 		 * If we don't have an activation yet, make one (it'll initially be
@@ -485,9 +919,6 @@ pllua_validate_and_push(lua_State *L,
 		for (;;)
 		{
 			pllua_function_info *func_info;
-			pllua_function_compile_info *comp_info;
-			MemoryContext fcxt;
-			MemoryContext ccxt;
 			HeapTuple	procTup;
 
 			/* Get the pg_proc tuple. */
@@ -547,77 +978,11 @@ pllua_validate_and_push(lua_State *L,
 
 			/*
 			 * If we get this far, we need to compile up the function from
-			 * scratch. Create the func_info, compile_info and contexts. Note
-			 * that the compile context is always transient, but the function
-			 * context is reparented to the long-lived lua context on success.
-			 *
-			 * (CurrentMemoryContext at this point is still the original
-			 * caller's context, assumed transient)
+			 * scratch. (CurrentMemoryContext at this point is still the
+			 * original caller's context, assumed transient)
 			 */
-			fcxt = AllocSetContextCreate(CurrentMemoryContext,
-										 "pllua function object",
-										 ALLOCSET_SMALL_SIZES);
-			ccxt = AllocSetContextCreate(CurrentMemoryContext,
-										 "pllua compile context",
-										 ALLOCSET_SMALL_SIZES);
-
-			func_info = MemoryContextAlloc(fcxt, sizeof(pllua_function_info));
-			func_info->mcxt = fcxt;
-
-			comp_info = MemoryContextAlloc(ccxt, sizeof(pllua_function_compile_info));
-			comp_info->mcxt = ccxt;
-			comp_info->func_info = func_info;
-
-			pllua_load_from_proctup(L, fn_oid,
-									func_info, comp_info,
-									procTup, trusted);
-
-			/*
-			 * Resolve the activation before compiling in case the user code
-			 * tries to do something that needs access to it.
-			 */
-			pllua_resolve_activation(L, act, func_info, fcinfo);
-
-			/*
-			 * Beware, compiling can invoke user-supplied code, which might
-			 * in turn recurse here. We trust that stack depth checks will
-			 * break any such loop if need be.
-			 */
-			pllua_pushcfunction(L, pllua_compile);
-			lua_pushlightuserdata(L, comp_info);
-			rc = pllua_pcall_nothrow(L, 1, 1, 0);
-
-			MemoryContextSwitchTo(oldcontext);
-			MemoryContextDelete(ccxt);
-
-			if (rc)
-			{
-				/* error. bail out */
-				act->resolved = false;
-				MemoryContextDelete(fcxt);
-				pllua_rethrow_from_lua(L, rc);
-			}
-			else
-			{
-				void **p = lua_touserdata(L, -1);
-				MemoryContextSetParent(fcxt, pllua_get_memory_cxt(L));
-				*p = func_info;
-			}
+			pllua_compile_and_intern(L, fn_oid, procTup, trusted, act, fcinfo);
 
-			/*
-			 * Try and intern the function. Since we uninterned it earlier, we
-			 * expect this to succeed, but a recursive call could have interned
-			 * a new version already (which will be at least as new as ours).
-			 * Worse, if so, that new version could already be out of date,
-			 * meaning that we have to loop back to check the pg_proc row
-			 * again.
-			 */
-			/* stack: activation funcinfo */
-			pllua_pushcfunction(L, pllua_intern_function);
-			lua_insert(L, -2);
-			lua_pushinteger(L, (lua_Integer) fn_oid);
-			pllua_pcall(L, 2, 0, 0);
-			func_info = NULL;
 			ReleaseSysCache(procTup);
 		}
 
@@ -898,3 +1263,256 @@ pllua_validate_function(lua_State *L,
 	}
 	PLLUA_CATCH_RETHROW();
 }
+
+/*
+ * Compile a function ahead of time without calling it, so that the first
+ * real call finds an up to date compiled function in the functions table,
+ * and look up the typeinfo objects for its argument and result types so
+ * that those are cached too.
+ *
+ * Nothing is done about activations; those belong to the caller's flinfo
+ * and are created (cheaply) on the first call as usual.
+ *
+ * Returns true if the function actually needed compiling.
+ */
+bool
+pllua_preload_function(lua_State *L, Oid fn_oid, bool trusted)
+{
+	volatile bool compiled = false;
+	Oid			typeoids[FUNC_MAX_ARGS + 1];
+	volatile int ntypes = 0;
+	int			i;
+
+	ASSERT_LUA_CONTEXT;
+
+	PLLUA_TRY();
+	{
+		HeapTuple	procTup;
+		Form_pg_proc procStruct;
+		pllua_function_info *func_info = NULL;
+
+		procTup = SearchSysCache1(PROCOID, ObjectIdGetDatum(fn_oid));
+		if (!HeapTupleIsValid(procTup))
+			elog(ERROR, "cache lookup failed for function %u", fn_oid);
+		procStruct = (Form_pg_proc) GETSTRUCT(procTup);
+
+		/*
+		 * Lookup function by oid in our lua table (this can't throw)
+		 */
+		lua_rawgetp(L, LUA_REGISTRYINDEX, PLLUA_FUNCS);
+		if (lua_rawgeti(L, -1, (lua_Integer) fn_oid) == LUA_TUSERDATA)
+		{
+			void **p = pllua_torefobject(L, -1, PLLUA_FUNCTION_OBJECT);
+			func_info = p ? *p : NULL;
+		}
+		lua_pop(L, 2);
+
+		if (!pllua_function_valid(func_info, procTup))
+		{
+			/* out of date or missing; unintern any old one first */
+			if (func_info)
+			{
+				pllua_pushcfunction(L, pllua_intern_function);
+				lua_pushnil(L);
+				lua_pushinteger(L, (lua_Integer) fn_oid);
+				pllua_pcall(L, 2, 0, 0);
+			}
+
+			pllua_compile_and_intern(L, fn_oid, procTup, trusted, NULL, NULL);
+			compiled = true;
+		}
+
+		/*
+		 * Polymorphic and other pseudotypes have nothing useful to look up
+		 * until call time.
+		 */
+		if (get_typtype(procStruct->prorettype) != TYPTYPE_PSEUDO)
+			typeoids[ntypes++] = procStruct->prorettype;
+		for (i = 0; i < procStruct->pronargs; ++i)
+		{
+			Oid		argtype = procStruct->proargtypes.values[i];
+
+			if (get_typtype(argtype) != TYPTYPE_PSEUDO)
+				typeoids[ntypes++] = argtype;
+		}
+
+		ReleaseSysCache(procTup);
+	}
+	PLLUA_CATCH_RETHROW();
+
+	for (i = 0; i < ntypes; ++i)
+	{
+		lua_pushcfunction(L, pllua_typeinfo_lookup);
+		lua_pushinteger(L, (lua_Integer) typeoids[i]);
+		lua_call(L, 1, 0);
+	}
+
+	return compiled;
+}
+
+/*
+ * Split the pllua.preload_functions value into entries. Entries are separated
+ * by commas, but commas inside parens (argument lists) or double quotes don't
+ * count. Whitespace around each entry is dropped.
+ */
+static List *
+pllua_split_preload_list(const char *str)
+{
+	List	   *result = NIL;
+	const char *start = str;
+	const char *p;
+	int			depth = 0;
+	bool		inquote = false;
+
+	for (p = str;; ++p)
+	{
+		char	c = *p;
+
+		if (c == '"')
+			inquote = !inquote;
+		else if (inquote && c)
+			continue;
+		else if (c == '(')
+			++depth;
+		else if (c == ')' && depth > 0)
+			--depth;
+		else if (c == '\0' || (c == ',' && depth == 0))
+		{
+			const char *end = p;
+
+			while (start < end && isspace((unsigned char) *start))
+				++start;
+			while (end > start && isspace((unsigned char) end[-1]))
+				--end;
+			if (end > start)
+				result = lappend(result, pnstrdup(start, end - start));
+			if (c == '\0')
+				break;
+			start = p + 1;
+		}
+	}
+
+	return result;
+}
+
+/*
+ * Resolve the entries of pllua.preload_functions to a list of function oids
+ * in the given language. An entry containing a paren is a function signature
+ * as accepted by regprocedure; anything else is a schema name, standing for
+ * every function of the language in that schema. Named functions in some
+ * other language are silently skipped, since the setting is shared between
+ * trusted and untrusted interpreters.
+ */
+static List *
+pllua_preload_list_oids(const char *str, Oid langoid)
+{
+	List	   *entries = pllua_split_preload_list(str);
+	List	   *result = NIL;
+	ListCell   *lc;
+
+	foreach(lc, entries)
+	{
+		char	   *entry = lfirst(lc);
+
+		if (strchr(entry, '('))
+		{
+			Oid			fn_oid;
+			HeapTuple	procTup;
+
+			fn_oid = DatumGetObjectId(DirectFunctionCall1(regprocedurein,
+														  CStringGetDatum(entry)));
+			procTup = SearchSysCache1(PROCOID, ObjectIdGetDatum(fn_oid));
+			if (!HeapTupleIsValid(procTup))
+				elog(ERROR, "cache lookup failed for function %u", fn_oid);
+			if (((Form_pg_proc) GETSTRUCT(procTup))->prolang == langoid)
+				result = lappend_oid(result, fn_oid);
+			ReleaseSysCache(procTup);
+		}
+		else
+		{
+			List	   *names = stringToQualifiedNameList(entry);
+			Oid			nspoid;
+			Relation	rel;
+			ScanKeyData key;
+			SysScanDesc scan;
+			HeapTuple	tup;
+
+			if (list_length(names) != 1)
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("invalid schema name \"%s\" in pllua.preload_functions",
+								entry)));
+			nspoid = get_namespace_oid(strVal(linitial(names)), false);
+
+			ScanKeyInit(&key,
+						Anum_pg_proc_pronamespace,
+						BTEqualStrategyNumber, F_OIDEQ,
+						ObjectIdGetDatum(nspoid));
+
+#if PG_VERSION_NUM >= 120000
+			rel = table_open(ProcedureRelationId, AccessShareLock);
+#else
+			rel = heap_open(ProcedureRelationId, AccessShareLock);
+#endif
+			scan = systable_beginscan(rel, InvalidOid, false, NULL, 1, &key);
+			while (HeapTupleIsValid(tup = systable_getnext(scan)))
+			{
+				Form_pg_proc procStruct = (Form_pg_proc) GETSTRUCT(tup);
+
+				if (procStruct->prolang != langoid)
+					continue;
+#if PG_VERSION_NUM >= 120000
+				result = lappend_oid(result, procStruct->oid);
+#else
+				result = lappend_oid(result, HeapTupleGetOid(tup));
+#endif
+			}
+			systable_endscan(scan);
+#if PG_VERSION_NUM >= 120000
+			table_close(rel, AccessShareLock);
+#else
+			heap_close(rel, AccessShareLock);
+#endif
+		}
+	}
+
+	return result;
+}
+
+/*
+ * Called at the end of interpreter setup to compile everything listed in
+ * pllua.preload_functions that belongs to this interpreter's language.
+ *
+ * Errors here are treated just like errors in the init strings, i.e. they
+ * abort the interpreter creation.
+ */
+int
+pllua_preload_function_list(lua_State *L)
+{
+	List	   *volatile oids = NIL;
+	List	   *list;
+	ListCell   *lc;
+	bool		trusted;
+	Oid			langoid;
+
+	if (!pllua_preload_functions || !*pllua_preload_functions)
+		return 0;
+
+	lua_rawgetp(L, LUA_REGISTRYINDEX, PLLUA_TRUSTED);
+	trusted = lua_toboolean(L, -1);
+	lua_rawgetp(L, LUA_REGISTRYINDEX, PLLUA_LANG_OID);
+	langoid = (Oid) lua_tointeger(L, -1);
+	lua_pop(L, 2);
+
+	PLLUA_TRY();
+	{
+		oids = pllua_preload_list_oids(pllua_preload_functions, langoid);
+	}
+	PLLUA_CATCH_RETHROW();
+
+	list = oids;
+	foreach(lc, list)
+		pllua_preload_function(L, lfirst_oid(lc), trusted);
+
+	return 0;
+}
@@ -5,17 +5,22 @@
 #include "access/htup_details.h"
 #include "access/sysattr.h"
 #include "access/tuptoaster.h"
+#include "catalog/namespace.h"
 #include "catalog/pg_type.h"
 #include "mb/pg_wchar.h"
 #include "parser/parse_coerce.h"
 #include "parser/parse_type.h"
 #include "utils/arrayaccess.h"
 #include "utils/builtins.h"
+#include "utils/date.h"
 #include "utils/datum.h"
 #include "utils/lsyscache.h"
 #include "utils/rangetypes.h"
+#include "utils/sortsupport.h"
 #include "utils/syscache.h"
+#include "utils/timestamp.h"
 #include "utils/typcache.h"
+#include "utils/uuid.h"
 
 #if PG_VERSION_NUM < 110000
 #define DatumGetRangeTypeP(d_) DatumGetRangeType(d_)
@@ -202,6 +207,13 @@ pllua_int64_get_datum(lua_State *L, int64 val)
 #endif
 }
 
+/*
+ * Seconds between the PG epoch (2000-01-01) and the Unix epoch, for the
+ * native representation of temporal types.
+ */
+#define PLLUA_UNIX_EPOCH_OFFSET \
+	((int64) (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY)
+
 /*
  * Get the typeid/typmod from a datum tuple, regardless of its toast status.
  *
@@ -315,6 +327,59 @@ int pllua_value_from_datum(lua_State *L,
 			}
 			return lua_type(L, -1);
 #endif
+
+		/*
+		 * These are only converted if pllua.native_types is set, since
+		 * existing code expects datum objects for them.
+		 */
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+			if (!pllua_native_types)
+				return LUA_TNONE;
+			{
+				Timestamp ts = DatumGetTimestamp(value);
+				if (TIMESTAMP_NOT_FINITE(ts))
+					lua_pushnumber(L, TIMESTAMP_IS_NOBEGIN(ts) ? -HUGE_VAL : HUGE_VAL);
+				else
+					lua_pushnumber(L, ((lua_Number) ts) / USECS_PER_SEC
+								   + (lua_Number) PLLUA_UNIX_EPOCH_OFFSET);
+			}
+			return LUA_TNUMBER;
+
+		case DATEOID:
+			if (!pllua_native_types)
+				return LUA_TNONE;
+			{
+				DateADT d = DatumGetDateADT(value);
+				if (DATE_NOT_FINITE(d))
+					lua_pushnumber(L, DATE_IS_NOBEGIN(d) ? -HUGE_VAL : HUGE_VAL);
+				else
+					lua_pushinteger(L, (lua_Integer) d * SECS_PER_DAY
+									+ PLLUA_UNIX_EPOCH_OFFSET);
+			}
+			return LUA_TNUMBER;
+
+		case INTERVALOID:
+			if (!pllua_native_types)
+				return LUA_TNONE;
+			{
+				Interval *iv = DatumGetIntervalP(value);
+				lua_createtable(L, 0, 3);
+				lua_pushinteger(L, (lua_Integer) iv->month);
+				lua_setfield(L, -2, "months");
+				lua_pushinteger(L, (lua_Integer) iv->day);
+				lua_setfield(L, -2, "days");
+				lua_pushinteger(L, (lua_Integer) iv->time);
+				lua_setfield(L, -2, "usecs");
+			}
+			return LUA_TTABLE;
+
+		case UUIDOID:
+			if (!pllua_native_types)
+				return LUA_TNONE;
+			lua_pushlstring(L, (const char *) DatumGetUUIDP(value)->data, UUID_LEN);
+			return LUA_TSTRING;
+
 		case REFCURSOROID:
 			lua_pushcfunction(L, pllua_spi_newcursor);
 			{
@@ -435,6 +500,17 @@ bool pllua_datum_from_value(lua_State *L, int nd,
 								*errstr = "invalid boolean value";
 						}
 						return true;
+
+					case UUIDOID:
+						/* the text forms are all longer than this */
+						if (pllua_native_types && len == UUID_LEN)
+						{
+							pg_uuid_t *u = pllua_palloc(L, sizeof(pg_uuid_t));
+							memcpy(u->data, str, UUID_LEN);
+							*result = UUIDPGetDatum(u);
+							return true;
+						}
+						break;
 				}
 			}
 			return false;
@@ -490,6 +566,47 @@ bool pllua_datum_from_value(lua_State *L, int nd,
 							*errstr = "bigint out of range";
 						return true;
 
+					case TIMESTAMPOID:
+					case TIMESTAMPTZOID:
+						if (!pllua_native_types)
+							break;
+						if (isinf(floatval))
+							*result = pllua_int64_get_datum(L, (floatval < 0) ? DT_NOBEGIN : DT_NOEND);
+						else
+						{
+							double usecs = rint((floatval - (double) PLLUA_UNIX_EPOCH_OFFSET)
+												* USECS_PER_SEC);
+							if (isnan(usecs) || usecs < -9.2e18 || usecs > 9.2e18
+#ifdef IS_VALID_TIMESTAMP
+								|| !IS_VALID_TIMESTAMP((int64) usecs)
+#endif
+								)
+								*errstr = "timestamp out of range";
+							else
+								*result = pllua_int64_get_datum(L, (int64) usecs);
+						}
+						return true;
+
+					case DATEOID:
+						if (!pllua_native_types)
+							break;
+						if (isinf(floatval))
+							*result = DateADTGetDatum((floatval < 0) ? DATEVAL_NOBEGIN : DATEVAL_NOEND);
+						else
+						{
+							double days = floor((floatval - (double) PLLUA_UNIX_EPOCH_OFFSET)
+												/ SECS_PER_DAY);
+							if (isnan(days) || days < PG_INT32_MIN || days > PG_INT32_MAX
+#ifdef IS_VALID_DATE
+								|| !IS_VALID_DATE((DateADT) days)
+#endif
+								)
+								*errstr = "date out of range";
+							else
+								*result = DateADTGetDatum((DateADT) days);
+						}
+						return true;
+
 					case NUMERICOID:
 						PLLUA_TRY();
 						{
@@ -504,6 +621,44 @@ bool pllua_datum_from_value(lua_State *L, int nd,
 			}
 			return false;
 
+		case LUA_TTABLE:
+			if (typeid == INTERVALOID && pllua_native_types)
+			{
+				static const char *const fields[] = { "months", "days", "usecs" };
+				lua_Integer vals[3];
+				Interval   *iv;
+				int			i;
+
+				for (i = 0; i < 3; ++i)
+				{
+					int isint = 1;
+					lua_pushstring(L, fields[i]);
+					if (lua_rawget(L, nd) == LUA_TNIL)
+						vals[i] = 0;
+					else
+						vals[i] = lua_tointegerx(L, -1, &isint);
+					lua_pop(L, 1);
+					if (!isint)
+					{
+						*errstr = "invalid interval value";
+						return true;
+					}
+				}
+				if (vals[0] < PG_INT32_MIN || vals[0] > PG_INT32_MAX ||
+					vals[1] < PG_INT32_MIN || vals[1] > PG_INT32_MAX)
+				{
+					*errstr = "interval out of range";
+					return true;
+				}
+				iv = pllua_palloc(L, sizeof(Interval));
+				iv->month = (int32) vals[0];
+				iv->day = (int32) vals[1];
+				iv->time = (TimeOffset) vals[2];
+				*result = IntervalPGetDatum(iv);
+				return true;
+			}
+			return false;
+
 		case LUA_TUSERDATA:
 			if (typeid == REFCURSOROID &&
 				pllua_toobject(L, nd, PLLUA_SPI_CURSOR_OBJECT))
@@ -669,7 +824,7 @@ static int pllua_datum_gc(lua_State *L)
 	lua_pushnil(L);
 	lua_setmetatable(L, 1);
 
-	PLLUA_TRY();
+	PLLUA_TRY_NOSUBXACT();
 	{
 		if (VARATT_IS_EXTERNAL_EXPANDED_RW(DatumGetPointer(p->value)))
 		{
@@ -2500,6 +2655,98 @@ static struct luaL_Reg datumobj_array_mt[] = {
 };
 
 
+/*
+ * Registry of direct transform callbacks.
+ *
+ * Transform modules call these from their _PG_init, passing the address of
+ * the C function that implements the SQL-level transform function along with
+ * a callback that does the same conversion without the fmgr call and the
+ * trampoline back into Lua. When a typeinfo is built, the transform functions
+ * are resolved to their addresses and matched against this list. The SQL
+ * functions must still exist, since that is what associates them with the
+ * type and language.
+ */
+#define PLLUA_MAX_DIRECT_TRANSFORMS 16
+
+typedef struct pllua_direct_transform
+{
+	PGFunction	func;
+	pllua_fromsql_transform_fn fromsql;
+	pllua_tosql_transform_fn tosql;
+} pllua_direct_transform;
+
+static pllua_direct_transform pllua_direct_transforms[PLLUA_MAX_DIRECT_TRANSFORMS];
+static int pllua_num_direct_transforms = 0;
+
+static void
+pllua_register_direct_transform(PGFunction func,
+								pllua_fromsql_transform_fn fromsql,
+								pllua_tosql_transform_fn tosql)
+{
+	int i;
+
+	for (i = 0; i < pllua_num_direct_transforms; ++i)
+	{
+		if (pllua_direct_transforms[i].func == func)
+			break;
+	}
+	if (i == pllua_num_direct_transforms)
+	{
+		if (i >= PLLUA_MAX_DIRECT_TRANSFORMS)
+			elog(ERROR, "too many pllua transform callbacks registered");
+		++pllua_num_direct_transforms;
+	}
+	pllua_direct_transforms[i].func = func;
+	pllua_direct_transforms[i].fromsql = fromsql;
+	pllua_direct_transforms[i].tosql = tosql;
+}
+
+void
+pllua_register_fromsql_transform(PGFunction func, pllua_fromsql_transform_fn fn)
+{
+	pllua_register_direct_transform(func, fn, NULL);
+}
+
+void
+pllua_register_tosql_transform(PGFunction func, pllua_tosql_transform_fn fn)
+{
+	pllua_register_direct_transform(func, NULL, fn);
+}
+
+/*
+ * Must be called in PG context. Loading the function's library here (if it
+ * was not loaded already) is what gives it a chance to register.
+ */
+static pllua_direct_transform *
+pllua_find_direct_transform(Oid funcoid)
+{
+	FmgrInfo	flinfo;
+	int			i;
+
+	if (!OidIsValid(funcoid))
+		return NULL;
+
+	fmgr_info(funcoid, &flinfo);
+
+	for (i = 0; i < pllua_num_direct_transforms; ++i)
+	{
+		if (pllua_direct_transforms[i].func == flinfo.fn_addr)
+			return &pllua_direct_transforms[i];
+	}
+	return NULL;
+}
+
+static void
+pllua_typeinfo_set_direct_transforms(pllua_typeinfo *t)
+{
+	pllua_direct_transform *dt;
+
+	dt = pllua_find_direct_transform(t->fromsql);
+	t->fromsql_direct = dt ? dt->fromsql : NULL;
+	dt = pllua_find_direct_transform(t->tosql);
+	t->tosql_direct = dt ? dt->tosql : NULL;
+}
+
 /*
  * This entry point allows constructing a typeinfo for an anonymous tupdesc, if
  * that turns out to be useful.
@@ -2578,6 +2825,7 @@ pllua_typeinfo *pllua_newtypeinfo_raw(lua_State *L, Oid oid, int32 typmod, Tuple
 		t->mcxt = mcxt;
 
 		t->typeoid = oid;
+		t->typhash = GetSysCacheHashValue1(TYPEOID, ObjectIdGetDatum(oid));
 		t->typmod = typmod;
 		t->tupdesc = NULL;
 		t->arity = 1;
@@ -2705,6 +2953,7 @@ pllua_typeinfo *pllua_newtypeinfo_raw(lua_State *L, Oid oid, int32 typmod, Tuple
 			List *l = list_make1_oid(oid);
 			t->fromsql = get_transform_fromsql(basetype, langoid, l);
 			t->tosql = get_transform_tosql(basetype, langoid, l);
+			pllua_typeinfo_set_direct_transforms(t);
 		}
 
 		MemoryContextSwitchTo(oldcontext);
@@ -3036,6 +3285,8 @@ int pllua_typeinfo_lookup(lua_State *L)
 
 				obj->fromsql = nobj->fromsql;
 				obj->tosql = nobj->tosql;
+				obj->fromsql_direct = nobj->fromsql_direct;
+				obj->tosql_direct = nobj->tosql_direct;
 			}
 			obj->revalidate = false;
 			lua_pop(L,2);
@@ -3065,51 +3316,130 @@ int pllua_typeinfo_lookup(lua_State *L)
 	return 1;
 }
 
+/*
+ * Does typeinfo t depend on any type whose oid is a key in the table at index
+ * "set"? Only the dependencies that typeinfo_eq looks at matter here: domain
+ * base type, array element type, and column types.
+ */
+static bool
+pllua_typeinfo_depends_on(lua_State *L, pllua_typeinfo *t, int set)
+{
+	int			i;
+
+	if (t->basetype != t->typeoid &&
+		lua_rawgeti(L, set, (lua_Integer) t->basetype) != LUA_TNIL)
+	{
+		lua_pop(L, 1);
+		return true;
+	}
+	lua_pop(L, 1);
+	if (OidIsValid(t->elemtype) &&
+		lua_rawgeti(L, set, (lua_Integer) t->elemtype) != LUA_TNIL)
+	{
+		lua_pop(L, 1);
+		return true;
+	}
+	lua_pop(L, 1);
+	if (t->tupdesc)
+	{
+		for (i = 0; i < t->natts; ++i)
+		{
+			Form_pg_attribute att = TupleDescAttr(t->tupdesc, i);
+
+			if (att->attisdropped)
+				continue;
+			if (lua_rawgeti(L, set, (lua_Integer) att->atttypid) != LUA_TNIL)
+			{
+				lua_pop(L, 1);
+				return true;
+			}
+			lua_pop(L, 1);
+		}
+	}
+	return false;
+}
+
 /*
  * invalidate(interp)
+ *
+ * Mark for revalidation only the typeinfos affected by the change: those whose
+ * TYPEOID hash value matches, or whose relation matches, and then (repeatedly)
+ * anything built on top of a type already marked, since typeinfo_eq compares
+ * the nested typeinfos by identity. A zero hash value or invalid relid means
+ * everything of that kind.
  */
 int pllua_typeinfo_invalidate(lua_State *L)
 {
 	pllua_interpreter *interp = lua_touserdata(L, 1);
-	Oid typoid = interp->inval->inval_typeoid;
-	Oid relid = interp->inval->inval_reloid;
+	uint32		typhash = interp->inval->inval_typhash;
+	Oid			relid = interp->inval->inval_reloid;
+	bool		inval_type = interp->inval->inval_type;
+	bool		inval_rel = interp->inval->inval_rel;
+	bool		changed;
+	int			types;
+	int			set;
 
 	lua_rawgetp(L, LUA_REGISTRYINDEX, PLLUA_TYPES);
+	types = lua_gettop(L);
 
-	if (interp->inval->inval_type)
+	if (inval_type && typhash == 0)
 	{
-		if (OidIsValid(typoid))
+		/* everything goes; no need to chase dependencies */
+		lua_pushnil(L);
+		while (lua_next(L, types))
 		{
-			pllua_typeinfo *t;
-			if (lua_rawgeti(L, -1, (lua_Integer) typoid) == LUA_TUSERDATA)
-			{
-				t = pllua_totypeinfo(L, -1);
+			pllua_typeinfo *t = pllua_totypeinfo(L, -1);
+			if (t)
 				t->revalidate = true;
-			}
+			lua_pop(L, 1);
 		}
-		else
+		return 0;
+	}
+
+	/* oids of the types marked so far */
+	lua_newtable(L);
+	set = lua_gettop(L);
+
+	lua_pushnil(L);
+	while (lua_next(L, types))
+	{
+		pllua_typeinfo *t = pllua_totypeinfo(L, -1);
+
+		if (t &&
+			((inval_type && t->typhash == typhash) ||
+			 (inval_rel && OidIsValid(t->reloid) &&
+			  (!OidIsValid(relid) || t->reloid == relid))))
 		{
-			lua_pushnil(L);
-			while (lua_next(L, -2))
-			{
-				pllua_typeinfo *t = pllua_totypeinfo(L, -1);
-				t->revalidate = true;
-				lua_pop(L,1);
-			}
+			t->revalidate = true;
+			lua_pushboolean(L, 1);
+			lua_rawseti(L, set, (lua_Integer) t->typeoid);
 		}
+		lua_pop(L, 1);
 	}
 
-	if (interp->inval->inval_rel)
+	/*
+	 * Propagate to dependent types. Dependency chains are short, so just
+	 * iterate until nothing changes.
+	 */
+	do
 	{
+		changed = false;
 		lua_pushnil(L);
-		while (lua_next(L, -2))
+		while (lua_next(L, types))
 		{
 			pllua_typeinfo *t = pllua_totypeinfo(L, -1);
-			if (t->reloid == relid)
+
+			if (t && !t->revalidate &&
+				pllua_typeinfo_depends_on(L, t, set))
+			{
 				t->revalidate = true;
-			lua_pop(L,1);
+				lua_pushboolean(L, 1);
+				lua_rawseti(L, set, (lua_Integer) t->typeoid);
+				changed = true;
+			}
+			lua_pop(L, 1);
 		}
-	}
+	} while (changed);
 
 	return 0;
 }
@@ -3128,7 +3458,7 @@ static int pllua_typeinfo_gc(lua_State *L)
 	if (!obj)
 		return 0;
 
-	PLLUA_TRY();
+	PLLUA_TRY_NOSUBXACT();
 	{
 		/*
 		 * typeinfo is allocated in its own memory context (since we expect it
@@ -3988,6 +4318,28 @@ static bool pllua_datum_transform_tosql(lua_State *L, int nargs, int argbase, in
 			lua_pop(L, 1);
 		return false;
 	}
+	if (t->tosql_direct)
+	{
+		pllua_datum *d = pllua_newdatum(L, nt, (Datum)0);
+		int base = lua_gettop(L);
+		Datum val = (Datum)0;
+		bool isnull = false;
+
+		if (!(*t->tosql_direct)(L, nargs, argbase, &val, &isnull))
+		{
+			lua_settop(L, base - 1);
+			return false;
+		}
+		lua_settop(L, base);
+		if (isnull)
+		{
+			lua_pop(L, 1);
+			lua_pushnil(L);
+		}
+		else
+			d->value = val;
+		return true;
+	}
 	luaL_checkstack(L, 10+nargs, NULL);
 	lua_pushvalue(L, nt);
 	pllua_newdatum(L, -1, (Datum)0);
@@ -4027,6 +4379,19 @@ int pllua_datum_transform_fromsql(lua_State *L, Datum val, int nidx, pllua_typei
 	if (!OidIsValid(t->fromsql))
 		return LUA_TNONE;
 
+	if (t->fromsql_direct)
+	{
+		nd = lua_gettop(L);
+		if ((*t->fromsql_direct)(L, val) == 0)
+		{
+			lua_settop(L, nd);
+			return LUA_TNONE;
+		}
+		if (lua_gettop(L) != nd + 1)
+			return luaL_error(L, "invalid return from transform function");
+		return lua_type(L, -1);
+	}
+
 	nidx = lua_absindex(L, nidx);
 	nd = lua_gettop(L);
 	lua_pushvalue(L, nidx);
@@ -5357,6 +5722,266 @@ int pllua_typeconv_invalidate(lua_State *L)
 	return 0;
 }
 
+/*
+ * Sorting of lua tables of datums using the type's btree sortsupport.
+ */
+typedef struct pllua_sort_item
+{
+	Datum		value;
+	Datum		abbrev;
+	bool		isnull;
+	int			idx;
+} pllua_sort_item;
+
+typedef struct pllua_sort_state
+{
+	SortSupportData ssup;
+	bool		abbreviated;
+} pllua_sort_state;
+
+/*
+ * Ties are broken on the original position, which makes the sort stable.
+ */
+static int
+pllua_sort_item_cmp(const void *a, const void *b, void *arg)
+{
+	const pllua_sort_item *ia = a;
+	const pllua_sort_item *ib = b;
+	pllua_sort_state *st = arg;
+	int			cmp;
+
+	if (st->abbreviated)
+	{
+		cmp = ApplySortComparator(ia->abbrev, ia->isnull,
+								  ib->abbrev, ib->isnull,
+								  &st->ssup);
+		if (cmp == 0 && !ia->isnull && !ib->isnull)
+			cmp = ApplySortAbbrevFullComparator(ia->value, false,
+												ib->value, false,
+												&st->ssup);
+	}
+	else
+		cmp = ApplySortComparator(ia->value, ia->isnull,
+								  ib->value, ib->isnull,
+								  &st->ssup);
+
+	if (cmp == 0)
+		cmp = (ia->idx < ib->idx) ? -1 : (ia->idx > ib->idx);
+	return cmp;
+}
+
+/*
+ * pgtype.sort(tbl, typeinfo [, opts])
+ *
+ * Sorts tbl[1..#tbl] in place and returns it. The sort keys are the elements
+ * themselves, or the result of applying opts.key (a function, or a column
+ * name or index to fetch from each element); keys that are not already
+ * datums of the specified type are converted as if by typeinfo(key), and nil
+ * keys sort as nulls.
+ *
+ * opts.desc and opts.nulls_first have the same meanings as DESC and NULLS
+ * FIRST in SQL (with the same defaults); opts.collation names the collation
+ * to use in place of the type's default.
+ */
+static int
+pllua_typeinfo_sort(lua_State *L)
+{
+	pllua_typeinfo *t;
+	pllua_sort_item *items;
+	lua_Integer n;
+	lua_Integer i;
+	bool		desc = false;
+	bool		nulls_first;
+	int			keyidx = 0;
+	const char *collname = NULL;
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+	if (lua_type(L, 2) == LUA_TSTRING)
+	{
+		lua_pushcfunction(L, pllua_typeinfo_parsetype);
+		lua_pushvalue(L, 2);
+		lua_call(L, 1, 1);
+		if (lua_isnil(L, -1))
+			luaL_error(L, "unknown type");
+		lua_replace(L, 2);
+	}
+	t = pllua_checktypeinfo(L, 2, true);
+	lua_settop(L, 3);
+
+	switch (lua_type(L, 3))
+	{
+		case LUA_TTABLE:
+			if (lua_getfield(L, 3, "desc") && lua_toboolean(L, -1))
+				desc = true;
+			lua_pop(L, 1);
+			nulls_first = desc;
+			if (lua_getfield(L, 3, "nulls_first") != LUA_TNIL)
+				nulls_first = lua_toboolean(L, -1);
+			lua_pop(L, 1);
+			if (lua_getfield(L, 3, "collation") != LUA_TNIL)
+				collname = luaL_checkstring(L, -1);
+			/* leave on stack (collname points into it) */
+			if (lua_getfield(L, 3, "key") != LUA_TNIL)
+				keyidx = lua_absindex(L, -1);
+			/* leave on stack */
+			break;
+		case LUA_TNIL:
+			nulls_first = false;
+			break;
+		default:
+			return luaL_argerror(L, 3, "table expected");
+	}
+
+	if (t->obsolete || t->modified)
+		luaL_error(L, "cannot sort values of a dropped or modified type");
+
+	n = lua_rawlen(L, 1);
+	if (n > (lua_Integer) (MaxAllocHugeSize / sizeof(pllua_sort_item)))
+		luaL_error(L, "table too large to sort");
+	if (n < 2)
+	{
+		lua_settop(L, 1);
+		return 1;
+	}
+
+	items = lua_newuserdata(L, n * sizeof(pllua_sort_item));
+	/* keep the key datums alive for the duration */
+	lua_createtable(L, (int) n, 0);
+
+	for (i = 1; i <= n; ++i)
+	{
+		pllua_sort_item *item = &items[i - 1];
+		pllua_datum *d;
+
+		lua_rawgeti(L, 1, i);
+		if (keyidx)
+		{
+			if (lua_type(L, keyidx) == LUA_TFUNCTION)
+			{
+				lua_pushvalue(L, keyidx);
+				lua_insert(L, -2);
+				lua_call(L, 1, 1);
+			}
+			else
+			{
+				lua_pushvalue(L, keyidx);
+				lua_gettable(L, -2);
+				lua_remove(L, -2);
+			}
+		}
+
+		item->idx = i;
+		item->abbrev = (Datum) 0;
+
+		if (lua_isnil(L, -1))
+		{
+			lua_pop(L, 1);
+			item->value = (Datum) 0;
+			item->isnull = true;
+			continue;
+		}
+
+		d = pllua_todatum(L, -1, 2);
+		if (!d)
+		{
+			lua_pushvalue(L, 2);
+			lua_insert(L, -2);
+			lua_call(L, 1, 1);
+			if (lua_isnil(L, -1))
+			{
+				lua_pop(L, 1);
+				item->value = (Datum) 0;
+				item->isnull = true;
+				continue;
+			}
+			d = pllua_checkdatum(L, -1, 2);
+		}
+		item->value = d->value;
+		item->isnull = false;
+		lua_rawseti(L, -2, i);
+	}
+
+	PLLUA_TRY();
+	{
+		MemoryContext mcxt = AllocSetContextCreate(CurrentMemoryContext,
+												   "pllua sort context",
+												   ALLOCSET_DEFAULT_SIZES);
+		MemoryContext oldcontext = MemoryContextSwitchTo(mcxt);
+		TypeCacheEntry *tc = lookup_type_cache(t->typeoid,
+											   TYPECACHE_LT_OPR | TYPECACHE_GT_OPR);
+		Oid			sortop = desc ? tc->gt_opr : tc->lt_opr;
+		pllua_sort_state st;
+
+		if (!OidIsValid(sortop))
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_FUNCTION),
+					 errmsg("could not identify an ordering operator for type %s",
+							format_type_be(t->typeoid))));
+
+		memset(&st, 0, sizeof(st));
+		st.ssup.ssup_cxt = mcxt;
+		st.ssup.ssup_collation = tc->typcollation;
+		if (collname)
+			st.ssup.ssup_collation = get_collation_oid(list_make1(makeString(pstrdup(collname))),
+													   false);
+		st.ssup.ssup_nulls_first = nulls_first;
+		st.ssup.abbreviate = true;
+
+		PrepareSortSupportFromOrderingOp(sortop, &st.ssup);
+
+		/*
+		 * Build abbreviated keys if the opclass offers them, checking the
+		 * opclass's cost model at the same doubling intervals tuplesort uses.
+		 */
+		if (st.ssup.abbrev_converter)
+		{
+			int			abbrev_next = 10;
+			int			j;
+
+			st.abbreviated = true;
+			for (j = 0; j < n; ++j)
+			{
+				if (j >= abbrev_next)
+				{
+					abbrev_next *= 2;
+					if (st.ssup.abbrev_abort(j, &st.ssup))
+					{
+						st.ssup.comparator = st.ssup.abbrev_full_comparator;
+						st.ssup.abbrev_converter = NULL;
+						st.abbreviated = false;
+						break;
+					}
+				}
+				if (!items[j].isnull)
+					items[j].abbrev = st.ssup.abbrev_converter(items[j].value, &st.ssup);
+			}
+		}
+
+		qsort_arg(items, n, sizeof(pllua_sort_item), pllua_sort_item_cmp, &st);
+
+		MemoryContextSwitchTo(oldcontext);
+		MemoryContextDelete(mcxt);
+	}
+	PLLUA_CATCH_RETHROW();
+
+	/*
+	 * Permute the original table. The elements go via the (now unneeded) key
+	 * table to avoid overwriting anything we have yet to read.
+	 */
+	for (i = 1; i <= n; ++i)
+	{
+		lua_rawgeti(L, 1, items[i - 1].idx);
+		lua_rawseti(L, -2, i);
+	}
+	for (i = 1; i <= n; ++i)
+	{
+		lua_rawgeti(L, -1, i);
+		lua_rawseti(L, 1, i);
+	}
+
+	lua_settop(L, 1);
+	return 1;
+}
 
 
 static struct luaL_Reg typeinfo_mt[] = {
@@ -5377,6 +6002,10 @@ static struct luaL_Reg typeinfo_methods[] = {
 };
 
 static struct luaL_Reg typeinfo_funcs[] = {
+	{ "func", pllua_pgfunc_handle_new },
+	{ "op", pllua_pgfunc_op_new },
+	{ "sort", pllua_typeinfo_sort },
+	{ "memory_stats", pllua_memory_stats },
 	{ NULL, NULL }
 };
 
@@ -5423,6 +6052,8 @@ int pllua_open_pgtype(lua_State *L)
 	pllua_newmetatable(L, PLLUA_IDXLIST_OBJECT, idxlist_mt);
 	lua_pop(L, 1);
 
+	pllua_init_pgfunc_handles(L);
+
 	pllua_newmetatable(L, PLLUA_TYPEINFO_OBJECT, typeinfo_mt);
 	lua_newtable(L);
 	luaL_setfuncs(L, typeinfo_methods, 0);
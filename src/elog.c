@@ -105,6 +105,7 @@ static void pllua_where(lua_State *L, int level)
 			fn == pllua_call_trigger ||
 			fn == pllua_call_event_trigger ||
 			fn == pllua_validate ||
+			fn == pllua_warmup ||
 			fn == pllua_call_inline)
 			break;
 		if (ar.currentline > 0)
@@ -243,6 +243,11 @@ pllua_rethrow_from_lua(lua_State *L, int rc)
 	if (rc == LUA_ERRMEM)
 	{
 		lua_pop(L, -1);
+		if (pllua_memory_limit_exceeded(L))
+			ereport(ERROR,
+					(errcode(ERRCODE_OUT_OF_MEMORY),
+					 errmsg("pllua: interpreter memory limit exceeded"),
+					 errhint("Consider increasing the configuration parameter \"pllua.max_interpreter_memory\".")));
 		elog(ERROR, "pllua: out of memory");
 	}
 
@@ -491,6 +496,23 @@ pllua_trampoline(lua_State *L)
 	return lua_gettop(L);
 }
 
+/*
+ * The reverse: direct transform callbacks run in Lua context, but can't use
+ * PLLUA_TRY since they can't see our context variable. So they pass their PG
+ * work to this instead.
+ */
+void
+pllua_call_pg(lua_State *L, void (*func)(void *), void *arg)
+{
+	ASSERT_LUA_CONTEXT;
+
+	PLLUA_TRY();
+	{
+		(*func)(arg);
+	}
+	PLLUA_CATCH_RETHROW();
+}
+
 /*
  * We store a lot of our state inside lua for convenience, but that means
  * we have to consider possible lua errors (e.g. out of memory) happening
@@ -515,8 +537,15 @@ pllua_initial_protected_call(pllua_interpreter *interp,
 
 	interp->cur_activation = *arg;  /* copies content not pointer */
 
+	/* lets invalidation callbacks know we can't wait for the next call */
+	++interp->active_depth;
+	++pllua_active_interpreters;
+
 	rc = pllua_cpcall(interp->L, func, &interp->cur_activation);
 
+	--pllua_active_interpreters;
+	--interp->active_depth;
+
 	/*
 	 * We better not have longjmp'd past any pg catch blocks.
 	 */
@@ -542,7 +571,7 @@ static int pllua_errobject_gc(lua_State *L)
 	*p = NULL;
 	if (obj)
 	{
-		PLLUA_TRY();
+		PLLUA_TRY_NOSUBXACT();
 		{
 			FreeErrorData(obj);
 		}
@@ -726,12 +755,21 @@ int pllua_t_lxpcall (lua_State *L) {
  *
  * This is all aimed at preserving the following invariant: we can only run the
  * user's Lua code inside an error-free subtransaction.
+ *
+ * Starting the subtransaction is deferred until the protected code first
+ * enters PG context (see PLLUA_TRY), since a great deal of pcall usage is for
+ * pure Lua code which has nothing to roll back. The invariant still holds for
+ * anything that can touch the database; the cost is that a pg error raised
+ * while the subtransaction is still pending (which can only come from the
+ * interrupt hook, or from failing to start the subtransaction) can't be
+ * caught, and is rethrown to the next level out as if there were no pcall.
  */
 
 typedef struct pllua_subxact
 {
 	volatile struct pllua_subxact *prev;
 	bool				onstack;
+	bool				started;
     ResourceOwner		resowner;
     MemoryContext		mcontext;
 	ResourceOwner		own_resowner;
@@ -739,13 +777,70 @@ typedef struct pllua_subxact
 
 static volatile pllua_subxact *subxact_stack_top = NULL;
 
+/*
+ * Number of entries on the subxact stack that have not been started. These
+ * are always the topmost entries.
+ */
+int pllua_pending_subxacts = 0;
+
+/*
+ * Start pending subxacts from the outermost inwards. PG context.
+ */
+static void
+pllua_start_subxacts(volatile pllua_subxact *xa)
+{
+	MemoryContext oldcontext;
+
+	if (!xa || xa->started)
+		return;
+
+	pllua_start_subxacts(xa->prev);
+
+	/*
+	 * Keep the caller's memory context rather than whatever
+	 * BeginInternalSubTransaction leaves us in; we might be in the middle of
+	 * something, and the pcall switches back to its own context afterwards
+	 * regardless.
+	 */
+	oldcontext = CurrentMemoryContext;
+	xa->resowner = CurrentResourceOwner;
+	BeginInternalSubTransaction(NULL);
+	MemoryContextSwitchTo(oldcontext);
+	xa->own_resowner = CurrentResourceOwner;
+	xa->started = true;
+	--pllua_pending_subxacts;
+}
+
+void
+pllua_start_pending_subxacts(lua_State *L)
+{
+	ASSERT_LUA_CONTEXT;
+
+	PLLUA_TRY_NOSUBXACT();
+	{
+		pllua_start_subxacts(subxact_stack_top);
+	}
+	PLLUA_CATCH_RETHROW();
+}
+
 static void
 pllua_subxact_abort(lua_State *L)
 {
-	PLLUA_TRY();
+	volatile pllua_subxact *xa = subxact_stack_top;
+
+	Assert(xa->onstack);
+
+	if (!xa->started)
+	{
+		/* nothing to roll back */
+		xa->onstack = false;
+		subxact_stack_top = xa->prev;
+		--pllua_pending_subxacts;
+		return;
+	}
+
+	PLLUA_TRY_NOSUBXACT();
 	{
-		volatile pllua_subxact *xa = subxact_stack_top;
-		Assert(xa->onstack);
 		xa->onstack = false;
 		subxact_stack_top = xa->prev;
 		RollbackAndReleaseCurrentSubTransaction();
@@ -807,7 +902,22 @@ pllua_intercept_error(lua_State *L)
 		 * do below).
 		 *
 		 * Abort the subxact and pop it.
+		 *
+		 * If the subxact was never started, though, a pg error can't be
+		 * handed to the user's handler since nothing was rolled back; leave
+		 * it registered and return it unchanged, and the pcall wrapper will
+		 * rethrow it.
 		 */
+		if (!subxact_stack_top->started &&
+			pllua_isobject(L, 1, PLLUA_ERROR_OBJECT) &&
+			pllua_get_active_error(L))
+		{
+			lua_pop(L, 1);
+			pllua_subxact_abort(L);
+			lua_settop(L, 1);
+			return 1;
+		}
+
 		pllua_subxact_abort(L);
 
 		/*
@@ -917,14 +1027,14 @@ pllua_t_pcall_guts(lua_State *L, bool is_xpcall)
 		xa.resowner = CurrentResourceOwner;
 		xa.mcontext = oldcontext;
 		xa.onstack = false;
+		xa.started = false;
 		xa.prev = subxact_stack_top;
 		xa.own_resowner = NULL;
 
-		BeginInternalSubTransaction(NULL);
-
+		/* started on demand by pllua_start_pending_subxacts */
 		xa.onstack = true;
-		xa.own_resowner = CurrentResourceOwner;
 		subxact_stack_top = &xa;
+		++pllua_pending_subxacts;
 
 		rc = pllua_pcall_nothrow(L,
 								 lua_gettop(L) - (is_xpcall ? 4 : 2),
@@ -934,15 +1044,29 @@ pllua_t_pcall_guts(lua_State *L, bool is_xpcall)
 		if (rc == LUA_OK)
 		{
 			/* Commit the inner transaction, return to outer xact context */
-			ReleaseCurrentSubTransaction();
+			if (xa.started)
+			{
+				ReleaseCurrentSubTransaction();
+				CurrentResourceOwner = xa.resowner;
+			}
+			else
+				--pllua_pending_subxacts;
 			MemoryContextSwitchTo(oldcontext);
-			CurrentResourceOwner = xa.resowner;
 
 			Assert(subxact_stack_top == &xa);
+			xa.onstack = false;
 			subxact_stack_top = xa.prev;
 		}
 		else if (xa.onstack)
+		{
+			/*
+			 * Without a subxact we can't catch a pg error, only lua ones; so
+			 * check the registry for a rethrow.
+			 */
+			if (!xa.started)
+				rethrow = true;
 			pllua_subxact_abort(L);
+		}
 		else
 		{
 			/*
@@ -620,3 +620,24 @@ pllua_validate(lua_State *L)
 
 	return 0;
 }
+
+/*
+ * Entry point for pllua_warmup(). Guts of this are in compile.c
+ *
+ * The function to compile is passed in validate_func; act->retval is set to
+ * true if it needed compiling.
+ */
+int
+pllua_warmup(lua_State *L)
+{
+	pllua_activation_record *act = lua_touserdata(L, 1);
+	Oid func_oid = act->validate_func;
+
+	pllua_common_lua_init(L, NULL);
+
+	act->retval = BoolGetDatum(pllua_preload_function(L, func_oid, act->trusted));
+
+	pllua_common_lua_exit(L);
+
+	return 0;
+}
@@ -13,6 +13,9 @@
     pllua_cpcall;
     pllua_pcall;
     pllua_trampoline;
+    pllua_call_pg;
+    pllua_register_fromsql_transform;
+    pllua_register_tosql_transform;
 
   local: *;
 };
@@ -21,6 +21,7 @@ char PLLUA_ACTIVATIONS[] = "activations";
 char PLLUA_TYPES[] = "types";
 char PLLUA_RECORDS[] = "records";
 char PLLUA_PORTALS[] = "cursors";
+char PLLUA_INLINE_CACHE[] = "inline cache";
 char PLLUA_TRUSTED[] = "trusted";
 char PLLUA_USERID[] = "userid";
 char PLLUA_LANG_OID[] = "language oid";
@@ -37,6 +38,14 @@ char PLLUA_TRIGGER_OBJECT[] = "trigger object";
 char PLLUA_EVENT_TRIGGER_OBJECT[] = "event trigger object";
 char PLLUA_SPI_STMT_OBJECT[] = "SPI statement object";
 char PLLUA_SPI_CURSOR_OBJECT[] = "SPI cursor object";
+char PLLUA_HASHMAP_OBJECT[] = "hashmap object";
+char PLLUA_NUMERIC_ACC_OBJECT[] = "numeric accumulator object";
+char PLLUA_JSONB_PROXY_OBJECT[] = "jsonb proxy object";
+char PLLUA_JSONB_ITER_OBJECT[] = "jsonb iterator object";
+char PLLUA_JSONB_PATH_OBJECT[] = "jsonb path object";
+char PLLUA_PGFUNC_HANDLE_OBJECT[] = "function handle object";
+char PLLUA_JSON_OBJECT_MT[] = "json object metatable";
+char PLLUA_JSON_ARRAY_MT[] = "json array metatable";
 char PLLUA_LAST_ERROR[] = "last error";
 char PLLUA_RECURSIVE_ERROR[] = "recursive error";
 char PLLUA_FUNCTION_MEMBER[] = "function element";
@@ -0,0 +1,758 @@
+/* hashmap.c */
+
+#include "pllua.h"
+
+#include "access/hash.h"
+#include "utils/lsyscache.h"
+#include "utils/typcache.h"
+
+/*
+ * Hash maps keyed by datum values.
+ *
+ * Datum objects can't usefully be used as Lua table keys, since two equal
+ * values are unlikely to be raw-equal. These maps hash and compare keys using
+ * the key type's default hash opclass instead.
+ *
+ * The table itself is open-addressed with linear probing. The slot array is a
+ * Lua userdata, and the key datums and values are kept in Lua tables indexed
+ * by slot number (1-based); all of these live in the map object's uservalue.
+ * This means that only hashing and comparing keys need to happen in PG
+ * context; growing the table and deleting entries (which we do by backward
+ * shifting, so there are no tombstones) are done purely on the Lua side.
+ */
+
+typedef struct pllua_hashmap_slot
+{
+	Datum		key;
+	uint32		hash;
+	bool		used;
+} pllua_hashmap_slot;
+
+typedef struct pllua_hashmap
+{
+	Oid			typeoid;
+	Oid			collation;
+	FmgrInfo   *hash_fn;
+	FmgrInfo   *eq_fn;
+	uint32		nslots;			/* always a power of 2 */
+	uint32		nitems;
+	pllua_hashmap_slot *slots;
+} pllua_hashmap;
+
+/*
+ * Used for bulk build and probe: one entry per input row.
+ */
+typedef struct pllua_hashmap_item
+{
+	Datum		key;
+	int			pos;			/* slot number, or -1 */
+	bool		isnew;
+} pllua_hashmap_item;
+
+#define PLLUA_HASHMAP_MIN_SLOTS 16
+
+static pllua_hashmap *
+pllua_checkhashmap(lua_State *L, int nd)
+{
+	return pllua_checkobject(L, nd, PLLUA_HASHMAP_OBJECT);
+}
+
+/*
+ * PG context. Find the slot holding key, returning its index, or if the key
+ * isn't present, -1 - (the index of the empty slot where it would go).
+ */
+static int
+pllua_hashmap_find(pllua_hashmap *h, Datum key, uint32 hash)
+{
+	uint32		mask = h->nslots - 1;
+	uint32		i = hash & mask;
+
+	while (h->slots[i].used)
+	{
+		if (h->slots[i].hash == hash &&
+			DatumGetBool(FunctionCall2Coll(h->eq_fn, h->collation,
+										   h->slots[i].key, key)))
+			return (int) i;
+		i = (i + 1) & mask;
+	}
+	return -1 - (int) i;
+}
+
+static uint32
+pllua_hashmap_hash(pllua_hashmap *h, Datum key)
+{
+	return DatumGetUInt32(FunctionCall1Coll(h->hash_fn, h->collation, key));
+}
+
+/*
+ * Make sure there's room for nnew more items without exceeding a load factor
+ * of 3/4, rebuilding the table if need be. Doesn't touch PG.
+ *
+ * Expects the map object at index 1.
+ */
+static void
+pllua_hashmap_reserve(lua_State *L, pllua_hashmap *h, lua_Integer nnew)
+{
+	lua_Integer	want = (lua_Integer) h->nitems + nnew;
+	lua_Integer	nslots = h->nslots;
+	pllua_hashmap_slot *oslots = h->slots;
+	pllua_hashmap_slot *nslotp;
+	uint32		mask;
+	uint32		i;
+	int			okeys;
+	int			ovals;
+
+	if (want * 4 <= nslots * 3)
+		return;
+
+	while (want * 4 > nslots * 3)
+	{
+		nslots *= 2;
+		if (nslots > (lua_Integer) (INT_MAX / 2))
+			luaL_error(L, "hashmap too large");
+	}
+
+	pllua_get_user_field(L, 1, "keys");
+	pllua_get_user_field(L, 1, "values");
+	okeys = lua_absindex(L, -2);
+	ovals = lua_absindex(L, -1);
+
+	nslotp = lua_newuserdata(L, nslots * sizeof(pllua_hashmap_slot));
+	memset(nslotp, 0, nslots * sizeof(pllua_hashmap_slot));
+	lua_createtable(L, (int) nslots, 0);
+	lua_createtable(L, (int) nslots, 0);
+
+	mask = (uint32) nslots - 1;
+	for (i = 0; i < h->nslots; ++i)
+	{
+		uint32		j;
+
+		if (!oslots[i].used)
+			continue;
+		j = oslots[i].hash & mask;
+		while (nslotp[j].used)
+			j = (j + 1) & mask;
+		nslotp[j] = oslots[i];
+		lua_rawgeti(L, okeys, i + 1);
+		lua_rawseti(L, -3, j + 1);
+		lua_rawgeti(L, ovals, i + 1);
+		lua_rawseti(L, -2, j + 1);
+	}
+
+	pllua_set_user_field(L, 1, "values");
+	pllua_set_user_field(L, 1, "keys");
+	pllua_set_user_field(L, 1, "slots");
+	h->slots = nslotp;
+	h->nslots = (uint32) nslots;
+	lua_pop(L, 2);
+}
+
+/*
+ * Remove the entry at slot pos, shifting back any following entries in the
+ * same probe run. Doesn't touch PG.
+ *
+ * Expects the map object at index 1.
+ */
+static void
+pllua_hashmap_remove(lua_State *L, pllua_hashmap *h, uint32 pos)
+{
+	uint32		mask = h->nslots - 1;
+	uint32		i = pos;
+	uint32		j = pos;
+	int			keys;
+	int			vals;
+
+	pllua_get_user_field(L, 1, "keys");
+	pllua_get_user_field(L, 1, "values");
+	keys = lua_absindex(L, -2);
+	vals = lua_absindex(L, -1);
+
+	for (;;)
+	{
+		uint32		k;
+
+		j = (j + 1) & mask;
+		if (!h->slots[j].used)
+			break;
+		k = h->slots[j].hash & mask;
+		/* entry at j can stay put if its home slot is cyclically in (i,j] */
+		if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		h->slots[i] = h->slots[j];
+		lua_rawgeti(L, keys, j + 1);
+		lua_rawseti(L, keys, i + 1);
+		lua_rawgeti(L, vals, j + 1);
+		lua_rawseti(L, vals, i + 1);
+		i = j;
+	}
+
+	h->slots[i].used = false;
+	h->slots[i].key = (Datum) 0;
+	lua_pushnil(L);
+	lua_rawseti(L, keys, i + 1);
+	lua_pushnil(L);
+	lua_rawseti(L, vals, i + 1);
+	--h->nitems;
+
+	lua_pop(L, 2);
+}
+
+/*
+ * Convert the value at nd to a datum of the map's key type and push it,
+ * returning NULL (and pushing nil) for null keys. If "copy" is set, a value
+ * that is already a datum of the right type is copied, so that stored keys
+ * can't be changed under us by modifications to the caller's datum.
+ *
+ * The key typeinfo is at nt.
+ */
+static pllua_datum *
+pllua_hashmap_tokey(lua_State *L, int nd, int nt, bool copy)
+{
+	pllua_datum *d;
+
+	nd = lua_absindex(L, nd);
+	nt = lua_absindex(L, nt);
+
+	if (lua_isnil(L, nd))
+	{
+		lua_pushnil(L);
+		return NULL;
+	}
+	d = pllua_todatum(L, nd, nt);
+	if (d && !copy)
+	{
+		lua_pushvalue(L, nd);
+		return d;
+	}
+	lua_pushvalue(L, nt);
+	lua_pushvalue(L, nd);
+	lua_call(L, 1, 1);
+	if (lua_isnil(L, -1))
+		return NULL;
+	return pllua_checkdatum(L, -1, nt);
+}
+
+/*
+ * Look up a key, returning its slot or -1 - (empty slot), and its hash.
+ */
+static int
+pllua_hashmap_lookup(lua_State *L, pllua_hashmap *h, Datum key, uint32 *hashp)
+{
+	volatile int pos = -1;
+	volatile uint32 hash = 0;
+
+	PLLUA_TRY();
+	{
+		hash = pllua_hashmap_hash(h, key);
+		pos = pllua_hashmap_find(h, key, hash);
+	}
+	PLLUA_CATCH_RETHROW();
+
+	if (hashp)
+		*hashp = hash;
+	return pos;
+}
+
+/*
+ * Push the key (or value) to use for the row at the top of the stack,
+ * replacing it. The extractor at idx is either nil (use the row itself), a
+ * function to call, or a field name/index.
+ */
+static void
+pllua_hashmap_extract(lua_State *L, int idx)
+{
+	switch (lua_type(L, idx))
+	{
+		case LUA_TNONE:
+		case LUA_TNIL:
+			break;
+		case LUA_TFUNCTION:
+			lua_pushvalue(L, idx);
+			lua_insert(L, -2);
+			lua_call(L, 1, 1);
+			break;
+		default:
+			lua_pushvalue(L, idx);
+			lua_gettable(L, -2);
+			lua_remove(L, -2);
+			break;
+	}
+}
+
+/*
+ * hashmap.new(typeinfo [, size])
+ */
+static int
+pllua_hashmap_new(lua_State *L)
+{
+	pllua_typeinfo *t;
+	pllua_hashmap *h;
+	lua_Integer	size = luaL_optinteger(L, 2, 0);
+	lua_Integer	nslots = PLLUA_HASHMAP_MIN_SLOTS;
+	MemoryContext mcxt;
+	pllua_hashmap_slot *slots;
+
+	if (lua_type(L, 1) == LUA_TSTRING)
+	{
+		lua_pushcfunction(L, pllua_typeinfo_parsetype);
+		lua_pushvalue(L, 1);
+		lua_call(L, 1, 1);
+		if (lua_isnil(L, -1))
+			luaL_error(L, "unknown type");
+		lua_replace(L, 1);
+	}
+	t = pllua_checktypeinfo(L, 1, true);
+	lua_settop(L, 1);
+
+	if (t->obsolete || t->modified)
+		luaL_error(L, "cannot use a dropped or modified type as a hashmap key");
+
+	while (size * 4 > nslots * 3)
+	{
+		nslots *= 2;
+		if (nslots > (lua_Integer) (INT_MAX / 2))
+			luaL_error(L, "hashmap too large");
+	}
+
+	h = pllua_newobject(L, PLLUA_HASHMAP_OBJECT, sizeof(pllua_hashmap), true);
+	lua_pushvalue(L, 1);
+	pllua_set_user_field(L, -2, "typeinfo");
+	slots = lua_newuserdata(L, nslots * sizeof(pllua_hashmap_slot));
+	memset(slots, 0, nslots * sizeof(pllua_hashmap_slot));
+	pllua_set_user_field(L, -2, "slots");
+	lua_createtable(L, (int) nslots, 0);
+	pllua_set_user_field(L, -2, "keys");
+	lua_createtable(L, (int) nslots, 0);
+	pllua_set_user_field(L, -2, "values");
+	lua_getuservalue(L, -1);
+	mcxt = pllua_newmemcontext(L, "pllua hashmap context", ALLOCSET_SMALL_SIZES);
+	lua_rawsetp(L, -2, PLLUA_MCONTEXT_MEMBER);
+	lua_pop(L, 1);
+
+	h->typeoid = t->typeoid;
+	h->slots = slots;
+	h->nslots = (uint32) nslots;
+	h->nitems = 0;
+
+	PLLUA_TRY();
+	{
+		TypeCacheEntry *tc = lookup_type_cache(t->typeoid,
+											   TYPECACHE_HASH_OPFAMILY);
+		Oid			eqop = InvalidOid;
+		Oid			hashproc = InvalidOid;
+
+		if (OidIsValid(tc->hash_opf))
+		{
+			eqop = get_opfamily_member(tc->hash_opf,
+									   tc->hash_opintype,
+									   tc->hash_opintype,
+									   HTEqualStrategyNumber);
+			hashproc = get_opfamily_proc(tc->hash_opf,
+										 tc->hash_opintype,
+										 tc->hash_opintype,
+										 HASHSTANDARD_PROC);
+		}
+		if (!OidIsValid(eqop) || !OidIsValid(hashproc))
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_FUNCTION),
+					 errmsg("could not identify a hash function for type %s",
+							format_type_be(t->typeoid))));
+
+		h->collation = tc->typcollation;
+		h->hash_fn = MemoryContextAllocZero(mcxt, sizeof(FmgrInfo));
+		h->eq_fn = MemoryContextAllocZero(mcxt, sizeof(FmgrInfo));
+		fmgr_info_cxt(hashproc, h->hash_fn, mcxt);
+		fmgr_info_cxt(get_opcode(eqop), h->eq_fn, mcxt);
+	}
+	PLLUA_CATCH_RETHROW();
+
+	return 1;
+}
+
+/*
+ * map:get(key)  returns the value, or nil
+ */
+static int
+pllua_hashmap_get(lua_State *L)
+{
+	pllua_hashmap *h = pllua_checkhashmap(L, 1);
+	pllua_datum *d;
+	int			pos;
+
+	lua_settop(L, 2);
+	pllua_get_user_field(L, 1, "typeinfo");
+	d = pllua_hashmap_tokey(L, 2, 3, false);
+	pos = (d && h->nitems > 0) ? pllua_hashmap_lookup(L, h, d->value, NULL) : -1;
+	if (pos < 0)
+	{
+		lua_pushnil(L);
+		return 1;
+	}
+	pllua_get_user_field(L, 1, "values");
+	lua_rawgeti(L, -1, pos + 1);
+	return 1;
+}
+
+/*
+ * map:set(key, value)  returns the map
+ *
+ * Setting a nil value deletes the key.
+ */
+static int
+pllua_hashmap_set(lua_State *L)
+{
+	pllua_hashmap *h = pllua_checkhashmap(L, 1);
+	bool		is_delete = lua_isnil(L, 3);
+	pllua_datum *d;
+	uint32		hash;
+	int			pos;
+
+	lua_settop(L, 3);
+	pllua_get_user_field(L, 1, "typeinfo");
+	d = pllua_hashmap_tokey(L, 2, 4, !is_delete);
+	if (!d)
+	{
+		if (!is_delete)
+			luaL_error(L, "hashmap key must not be null");
+		lua_settop(L, 1);
+		return 1;
+	}
+
+	if (is_delete)
+	{
+		pos = (h->nitems > 0) ? pllua_hashmap_lookup(L, h, d->value, NULL) : -1;
+		if (pos >= 0)
+			pllua_hashmap_remove(L, h, (uint32) pos);
+		lua_settop(L, 1);
+		return 1;
+	}
+
+	pllua_hashmap_reserve(L, h, 1);
+	pos = pllua_hashmap_lookup(L, h, d->value, &hash);
+	if (pos < 0)
+	{
+		pos = -1 - pos;
+		h->slots[pos].key = d->value;
+		h->slots[pos].hash = hash;
+		h->slots[pos].used = true;
+		++h->nitems;
+		pllua_get_user_field(L, 1, "keys");
+		lua_pushvalue(L, 5);
+		lua_rawseti(L, -2, pos + 1);
+		lua_pop(L, 1);
+	}
+	pllua_get_user_field(L, 1, "values");
+	lua_pushvalue(L, 3);
+	lua_rawseti(L, -2, pos + 1);
+	lua_settop(L, 1);
+	return 1;
+}
+
+/*
+ * map:build(rows, key [, value])  returns the map
+ *
+ * Bulk insert from a list of rows (e.g. an SPI result). "key" and "value"
+ * select what to use from each row: nil for the row itself, a function to
+ * call on the row, or a field to index it with. Rows with null keys or nil
+ * values are skipped (a nil value can't be stored, and unlike in set() we
+ * don't treat it as a delete); on duplicate keys the last one wins.
+ *
+ * All the hashing and probing is done in a single pass in PG context.
+ */
+static int
+pllua_hashmap_build(lua_State *L)
+{
+	pllua_hashmap *h = pllua_checkhashmap(L, 1);
+	pllua_hashmap_item *items;
+	lua_Integer	n;
+	lua_Integer	nkeys = 0;
+	lua_Integer	i;
+
+	luaL_checktype(L, 2, LUA_TTABLE);
+	lua_settop(L, 4);
+	pllua_get_user_field(L, 1, "typeinfo");		/* index 5 */
+
+	n = lua_rawlen(L, 2);
+	if (n > (lua_Integer) (MaxAllocHugeSize / sizeof(pllua_hashmap_item)))
+		luaL_error(L, "too many rows");
+	items = lua_newuserdata(L, (n ? n : 1) * sizeof(pllua_hashmap_item));	/* 6 */
+	lua_createtable(L, (int) n, 0);		/* 7: key datums */
+	lua_createtable(L, (int) n, 0);		/* 8: values */
+
+	for (i = 0; i < n; ++i)
+	{
+		pllua_datum *d = NULL;
+		bool		skip;
+
+		lua_rawgeti(L, 2, i + 1);
+		lua_pushvalue(L, -1);
+		pllua_hashmap_extract(L, 4);
+		skip = lua_isnil(L, -1);
+		lua_rawseti(L, 8, i + 1);
+		pllua_hashmap_extract(L, 3);
+		if (!skip)
+			d = pllua_hashmap_tokey(L, -1, 5, true);
+		items[i].key = d ? d->value : (Datum) 0;
+		items[i].pos = d ? 0 : -1;
+		items[i].isnew = false;
+		if (d)
+			++nkeys;
+		lua_rawseti(L, 7, i + 1);
+		lua_pop(L, 1);
+	}
+
+	pllua_hashmap_reserve(L, h, nkeys);
+
+	PLLUA_TRY();
+	{
+		volatile lua_Integer done = 0;
+
+		/*
+		 * If we fail partway, undo the insertions we did. Working backwards,
+		 * each slot to clear was the most recently filled one, so simply
+		 * emptying it restores the previous state exactly.
+		 */
+		PG_TRY();
+		{
+			for (; done < n; ++done)
+			{
+				pllua_hashmap_item *item = &items[done];
+				uint32		hash;
+				int			pos;
+
+				if (item->pos < 0)
+					continue;
+				hash = pllua_hashmap_hash(h, item->key);
+				pos = pllua_hashmap_find(h, item->key, hash);
+				if (pos < 0)
+				{
+					pos = -1 - pos;
+					h->slots[pos].key = item->key;
+					h->slots[pos].hash = hash;
+					h->slots[pos].used = true;
+					++h->nitems;
+					item->isnew = true;
+				}
+				item->pos = pos;
+			}
+		}
+		PG_CATCH();
+		{
+			while (done-- > 0)
+			{
+				pllua_hashmap_item *item = &items[done];
+
+				if (item->isnew)
+				{
+					h->slots[item->pos].used = false;
+					h->slots[item->pos].key = (Datum) 0;
+					--h->nitems;
+				}
+			}
+			PG_RE_THROW();
+		}
+		PG_END_TRY();
+	}
+	PLLUA_CATCH_RETHROW();
+
+	pllua_get_user_field(L, 1, "keys");		/* 9 */
+	pllua_get_user_field(L, 1, "values");	/* 10 */
+	for (i = 0; i < n; ++i)
+	{
+		int			pos = items[i].pos;
+
+		if (pos < 0)
+			continue;
+		if (items[i].isnew)
+		{
+			lua_rawgeti(L, 7, i + 1);
+			lua_rawseti(L, 9, pos + 1);
+		}
+		lua_rawgeti(L, 8, i + 1);
+		lua_rawseti(L, 10, pos + 1);
+	}
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+/*
+ * iterator for map:probe()
+ *
+ * upvalues: rows, items, values table, nitems, next index
+ */
+static int
+pllua_hashmap_probe_next(lua_State *L)
+{
+	pllua_hashmap_item *items = lua_touserdata(L, lua_upvalueindex(2));
+	lua_Integer	n = lua_tointeger(L, lua_upvalueindex(4));
+	lua_Integer	i = lua_tointeger(L, lua_upvalueindex(5));
+
+	for (; i < n; ++i)
+	{
+		if (items[i].pos < 0)
+			continue;
+		if (lua_rawgeti(L, lua_upvalueindex(3), items[i].pos + 1) == LUA_TNIL)
+		{
+			lua_pop(L, 1);
+			continue;
+		}
+		lua_rawgeti(L, lua_upvalueindex(1), i + 1);
+		lua_insert(L, -2);
+		lua_pushinteger(L, i + 1);
+		lua_replace(L, lua_upvalueindex(5));
+		return 2;
+	}
+
+	lua_pushinteger(L, n);
+	lua_replace(L, lua_upvalueindex(5));
+	return 0;
+}
+
+/*
+ * map:probe(rows, key)
+ *
+ * Returns an iterator yielding (row, value) for each row of "rows" (in order)
+ * whose key is present in the map; "key" is as for map:build. All the lookups
+ * are done up front in one pass; the map should not be modified while the
+ * iteration is in progress.
+ */
+static int
+pllua_hashmap_probe(lua_State *L)
+{
+	pllua_hashmap *h = pllua_checkhashmap(L, 1);
+	pllua_hashmap_item *items;
+	lua_Integer	n;
+	lua_Integer	i;
+
+	luaL_checktype(L, 2, LUA_TTABLE);
+	lua_settop(L, 3);
+	pllua_get_user_field(L, 1, "typeinfo");		/* index 4 */
+
+	n = lua_rawlen(L, 2);
+	if (n > (lua_Integer) (MaxAllocHugeSize / sizeof(pllua_hashmap_item)))
+		luaL_error(L, "too many rows");
+	items = lua_newuserdata(L, (n ? n : 1) * sizeof(pllua_hashmap_item));	/* 5 */
+	lua_createtable(L, (int) n, 0);		/* 6: key datums */
+
+	for (i = 0; i < n; ++i)
+	{
+		pllua_datum *d;
+
+		lua_rawgeti(L, 2, i + 1);
+		pllua_hashmap_extract(L, 3);
+		d = pllua_hashmap_tokey(L, -1, 4, false);
+		items[i].key = d ? d->value : (Datum) 0;
+		items[i].pos = (d && h->nitems > 0) ? 0 : -1;
+		items[i].isnew = false;
+		lua_rawseti(L, 6, i + 1);
+		lua_pop(L, 1);
+	}
+
+	PLLUA_TRY();
+	{
+		for (i = 0; i < n; ++i)
+		{
+			pllua_hashmap_item *item = &items[i];
+			int			pos;
+
+			if (item->pos < 0)
+				continue;
+			pos = pllua_hashmap_find(h, item->key,
+									 pllua_hashmap_hash(h, item->key));
+			item->pos = (pos < 0) ? -1 : pos;
+		}
+	}
+	PLLUA_CATCH_RETHROW();
+
+	lua_pushvalue(L, 2);
+	lua_pushvalue(L, 5);
+	pllua_get_user_field(L, 1, "values");
+	lua_pushinteger(L, n);
+	lua_pushinteger(L, 0);
+	lua_pushcclosure(L, pllua_hashmap_probe_next, 5);
+	return 1;
+}
+
+/*
+ * iterator for pairs(map)
+ *
+ * upvalues: map, next slot index
+ */
+static int
+pllua_hashmap_next(lua_State *L)
+{
+	pllua_hashmap *h = pllua_checkhashmap(L, lua_upvalueindex(1));
+	lua_Integer	i = lua_tointeger(L, lua_upvalueindex(2));
+
+	for (; i < h->nslots; ++i)
+	{
+		if (!h->slots[i].used)
+			continue;
+		pllua_get_user_field(L, lua_upvalueindex(1), "keys");
+		lua_rawgeti(L, -1, i + 1);
+		pllua_get_user_field(L, lua_upvalueindex(1), "values");
+		lua_rawgeti(L, -1, i + 1);
+		lua_remove(L, -2);
+		lua_remove(L, -3);
+		lua_pushinteger(L, i + 1);
+		lua_replace(L, lua_upvalueindex(2));
+		return 2;
+	}
+
+	lua_pushinteger(L, i);
+	lua_replace(L, lua_upvalueindex(2));
+	return 0;
+}
+
+static int
+pllua_hashmap_pairs(lua_State *L)
+{
+	pllua_checkhashmap(L, 1);
+	lua_settop(L, 1);
+	lua_pushinteger(L, 0);
+	lua_pushcclosure(L, pllua_hashmap_next, 2);
+	return 1;
+}
+
+static int
+pllua_hashmap_len(lua_State *L)
+{
+	pllua_hashmap *h = pllua_checkhashmap(L, 1);
+	lua_pushinteger(L, h->nitems);
+	return 1;
+}
+
+static struct luaL_Reg hashmap_mt[] = {
+	{ "__len", pllua_hashmap_len },
+	{ "__pairs", pllua_hashmap_pairs },
+	{ NULL, NULL }
+};
+
+static struct luaL_Reg hashmap_methods[] = {
+	{ "build", pllua_hashmap_build },
+	{ "get", pllua_hashmap_get },
+	{ "pairs", pllua_hashmap_pairs },
+	{ "probe", pllua_hashmap_probe },
+	{ "set", pllua_hashmap_set },
+	{ NULL, NULL }
+};
+
+static struct luaL_Reg hashmap_funcs[] = {
+	{ "new", pllua_hashmap_new },
+	{ NULL, NULL }
+};
+
+int pllua_open_hashmap(lua_State *L)
+{
+	lua_settop(L, 0);
+	pllua_newmetatable(L, PLLUA_HASHMAP_OBJECT, hashmap_mt);
+	lua_newtable(L);
+	luaL_setfuncs(L, hashmap_methods, 0);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+
+	lua_newtable(L);
+	luaL_setfuncs(L, hashmap_funcs, 0);
+	return 1;
+}
@@ -31,6 +31,9 @@ static char *pllua_on_trusted_init = NULL;
 static char *pllua_on_untrusted_init = NULL;
 static char *pllua_on_common_init = NULL;
 static bool pllua_do_check_for_interrupts = true;
+static bool pllua_context_allocator = false;
+static int pllua_max_interpreter_memory = 0;	/* kB, 0 = unlimited */
+static int pllua_interrupt_check_interval = 10000;
 /* trusted.c also needs this */
 bool pllua_do_install_globals = true;
 static int pllua_num_held_interpreters = 1;
@@ -43,6 +46,14 @@ static const char *pllua_pg_version_num = NULL;
 
 bool pllua_track_gc_debt = false;
 
+/* datum.c needs this */
+bool pllua_native_types = false;
+
+/* compile.c needs these */
+bool pllua_bytecode_cache = false;
+char *pllua_preload_functions = NULL;
+int pllua_inline_cache_size = 32;
+
 static lua_State *pllua_newstate_phase1(const char *ident);
 static void pllua_newstate_phase2(lua_State *L,
 								  bool trusted,
@@ -50,7 +61,6 @@ static void pllua_newstate_phase2(lua_State *L,
 								  pllua_interpreter *interp_desc,
 								  pllua_activation_record *act);
 static void pllua_fini(int code, Datum arg);
-static void *pllua_alloc (void *ud, void *ptr, size_t osize, size_t nsize);
 
 /*
  * pllua_getstate
@@ -72,6 +82,8 @@ pllua_getstate(bool trusted, pllua_activation_record *act)
 
 	if (found && interp_desc->L)
 	{
+		pllua_check_invalidations(interp_desc);
+
 		if (interp_desc->new_ident)
 		{
 			lua_State *L = interp_desc->L;
@@ -90,6 +102,11 @@ pllua_getstate(bool trusted, pllua_activation_record *act)
 
 		interp_desc->gc_debt = 0;
 
+		interp_desc->active_depth = 0;
+		interp_desc->type_generation = 0;
+		interp_desc->rel_generation = 0;
+		interp_desc->cast_generation = 0;
+
 		interp_desc->cur_activation.fcinfo = NULL;
 		interp_desc->cur_activation.retval = (Datum) 0;
 		interp_desc->cur_activation.trusted = trusted;
@@ -336,6 +353,13 @@ void _PG_init(void)
 							   NULL,
 							   PGC_SUSET, 0,
 							   NULL, NULL, NULL);
+	DefineCustomStringVariable("pllua.preload_functions",
+							   gettext_noop("Functions or schemas to compile when a Lua interpreter is initialized."),
+							   NULL,
+							   &pllua_preload_functions,
+							   NULL,
+							   PGC_SUSET, 0,
+							   NULL, NULL, NULL);
 	DefineCustomBoolVariable("pllua.install_globals",
 							 gettext_noop("Install key modules as global tables."),
 							 NULL,
@@ -343,6 +367,20 @@ void _PG_init(void)
 							 true,
 							 PGC_SUSET, 0,
 							 NULL, NULL, NULL);
+	DefineCustomBoolVariable("pllua.native_types",
+							 gettext_noop("Convert timestamp, date, interval and uuid values to native Lua values."),
+							 NULL,
+							 &pllua_native_types,
+							 false,
+							 PGC_USERSET, 0,
+							 NULL, NULL, NULL);
+	DefineCustomBoolVariable("pllua.bytecode_cache",
+							 gettext_noop("Cache compiled function bytecode on disk for use by other sessions."),
+							 NULL,
+							 &pllua_bytecode_cache,
+							 false,
+							 PGC_SUSET, 0,
+							 NULL, NULL, NULL);
 	DefineCustomBoolVariable("pllua.check_for_interrupts",
 							 gettext_noop("Check for query cancels while running the Lua interpreter."),
 							 NULL,
@@ -350,6 +388,40 @@ void _PG_init(void)
 							 true,
 							 PGC_SUSET, 0,
 							 NULL, NULL, NULL);
+	DefineCustomBoolVariable("pllua.context_allocator",
+							 gettext_noop("Allocate the Lua heap from a PostgreSQL memory context rather than malloc."),
+							 NULL,
+							 &pllua_context_allocator,
+							 false,
+							 PGC_SUSET, 0,
+							 NULL, NULL, NULL);
+	DefineCustomIntVariable("pllua.max_interpreter_memory",
+							gettext_noop("Maximum memory that any one Lua interpreter may use."),
+							gettext_noop("0 means no limit."),
+							&pllua_max_interpreter_memory,
+							0,
+							0,
+							MAX_KILOBYTES,
+							PGC_SUSET, GUC_UNIT_KB,
+							NULL, NULL, NULL);
+	DefineCustomIntVariable("pllua.interrupt_check_interval",
+							gettext_noop("Number of Lua VM instructions between checks for query cancels."),
+							NULL,
+							&pllua_interrupt_check_interval,
+							10000,
+							1,
+							INT_MAX,
+							PGC_SUSET, 0,
+							NULL, NULL, NULL);
+	DefineCustomIntVariable("pllua.inline_cache_size",
+							gettext_noop("Number of compiled DO blocks to keep in each interpreter."),
+							NULL,
+							&pllua_inline_cache_size,
+							32,
+							0,
+							100000,
+							PGC_USERSET, 0,
+							NULL, NULL, NULL);
 	DefineCustomIntVariable("pllua.prebuilt_interpreters",
 							gettext_noop("Number of interpreters to prebuild if preloaded"),
 							NULL,
@@ -463,92 +535,425 @@ pllua_fini(int code, Datum arg)
 }
 
 /*
- * Broadcast an invalidation to all interpreters (if arg==0) or the specified
- * interpreter.
+ * Cache invalidation.
+ *
+ * Rather than entering every interpreter for every invalidation message, the
+ * callbacks just bump a generation counter for the kind of cache involved and
+ * record what was invalidated in a small ring. Each interpreter remembers the
+ * generations it has seen, and catches up (in pllua_getstate) the next time it
+ * is used; if it has fallen more than a ring's worth behind, it invalidates
+ * everything of that kind instead. Cast invalidations carry no detail, so any
+ * number of them is a single invalidation.
+ *
+ * Interpreters that are currently running Lua code (entered via
+ * pllua_initial_protected_call) can't wait for their next call, since the
+ * running code may have done DDL via SPI and then use the changed types, so
+ * the callback catches those up immediately.
  */
+#define PLLUA_INVAL_RING_SIZE 64
+
+static uint64 pllua_type_generation = 0;
+static uint64 pllua_rel_generation = 0;
+static uint64 pllua_cast_generation = 0;
+static uint32 pllua_type_inval_ring[PLLUA_INVAL_RING_SIZE];
+static Oid pllua_rel_inval_ring[PLLUA_INVAL_RING_SIZE];
+
+/* error.c needs this */
+int pllua_active_interpreters = 0;
+
 static void
-pllua_callback_broadcast(Datum arg, lua_CFunction cfunc, pllua_cache_inval *inval)
+pllua_apply_inval(pllua_interpreter *interp_desc,
+				  lua_CFunction cfunc,
+				  pllua_cache_inval *inval)
+{
+	lua_State *L = interp_desc->L;
+	int rc;
+
+	interp_desc->inval = inval;
+	rc = pllua_cpcall(L, /* keep line split to avoid functable hack */
+					  cfunc,
+					  interp_desc);
+	if (rc)
+		pllua_poperror(L);
+}
+
+/*
+ * Bring one interpreter up to date with the invalidations it has missed.
+ */
+void
+pllua_check_invalidations(pllua_interpreter *interp_desc)
+{
+	pllua_cache_inval inval;
+	uint64		gen;
+
+	if (!interp_desc->L)
+		return;
+
+	if (interp_desc->cast_generation != pllua_cast_generation)
+	{
+		interp_desc->cast_generation = pllua_cast_generation;
+		memset(&inval, 0, sizeof(inval));
+		inval.inval_cast = true;
+		pllua_apply_inval(interp_desc, pllua_register_cfunc(L, pllua_typeconv_invalidate), &inval);
+	}
+
+	if (interp_desc->type_generation != pllua_type_generation)
+	{
+		gen = interp_desc->type_generation;
+		interp_desc->type_generation = pllua_type_generation;
+		memset(&inval, 0, sizeof(inval));
+		inval.inval_type = true;
+		if (pllua_type_generation - gen > PLLUA_INVAL_RING_SIZE)
+			pllua_apply_inval(interp_desc, pllua_register_cfunc(L, pllua_typeinfo_invalidate), &inval);
+		else
+		{
+			for (; gen < pllua_type_generation; ++gen)
+			{
+				inval.inval_typhash = pllua_type_inval_ring[gen % PLLUA_INVAL_RING_SIZE];
+				pllua_apply_inval(interp_desc, pllua_register_cfunc(L, pllua_typeinfo_invalidate), &inval);
+				if (inval.inval_typhash == 0)
+					break;		/* did everything */
+			}
+		}
+	}
+
+	if (interp_desc->rel_generation != pllua_rel_generation)
+	{
+		gen = interp_desc->rel_generation;
+		interp_desc->rel_generation = pllua_rel_generation;
+		memset(&inval, 0, sizeof(inval));
+		inval.inval_rel = true;
+		if (pllua_rel_generation - gen > PLLUA_INVAL_RING_SIZE)
+			pllua_apply_inval(interp_desc, pllua_register_cfunc(L, pllua_typeinfo_invalidate), &inval);
+		else
+		{
+			for (; gen < pllua_rel_generation; ++gen)
+			{
+				inval.inval_reloid = pllua_rel_inval_ring[gen % PLLUA_INVAL_RING_SIZE];
+				pllua_apply_inval(interp_desc, pllua_register_cfunc(L, pllua_typeinfo_invalidate), &inval);
+				if (!OidIsValid(inval.inval_reloid))
+					break;		/* did everything */
+			}
+		}
+	}
+}
+
+/*
+ * Catch up any interpreters that are in the middle of running something.
+ */
+static void
+pllua_check_active_invalidations(void)
 {
 	HASH_SEQ_STATUS hash_seq;
 	pllua_interpreter *interp_desc;
 
+	if (pllua_active_interpreters == 0)
+		return;
+
 	hash_seq_init(&hash_seq, pllua_interp_hash);
 	while ((interp_desc = hash_seq_search(&hash_seq)) != NULL)
 	{
-		lua_State *L = interp_desc->L;
-		if (L
-			&& (arg == (Datum)0
-				|| arg == PointerGetDatum(interp_desc)))
-		{
-			int rc;
-			interp_desc->inval = inval;
-			rc = pllua_cpcall(L, /* keep line split to avoid functable hack */
-							  cfunc,
-							  interp_desc);
-			if (rc)
-				pllua_poperror(L);
-		}
+		if (interp_desc->active_depth > 0)
+			pllua_check_invalidations(interp_desc);
 	}
 }
 
+/*
+ * A nonzero arg means the callback was called directly by us for just that
+ * interpreter (at creation time), in which case we apply it directly.
+ */
 static void
 pllua_relcache_callback(Datum arg, Oid relid)
 {
-	pllua_cache_inval inval;
+	if (arg != (Datum) 0)
+	{
+		pllua_cache_inval inval;
+
+		memset(&inval, 0, sizeof(inval));
+		inval.inval_rel = true;
+		inval.inval_reloid = relid;
+		pllua_apply_inval((pllua_interpreter *) DatumGetPointer(arg),
+						  pllua_register_cfunc(L, pllua_typeinfo_invalidate), &inval);
+		return;
+	}
 
-	memset(&inval, 0, sizeof(inval));
-	inval.inval_rel = true;
-	inval.inval_reloid = InvalidOid;
-	pllua_callback_broadcast(arg, pllua_register_cfunc(L, pllua_typeinfo_invalidate), &inval);
+	pllua_rel_inval_ring[pllua_rel_generation % PLLUA_INVAL_RING_SIZE] = relid;
+	++pllua_rel_generation;
+	pllua_check_active_invalidations();
 }
 
 static void
 pllua_syscache_typeoid_callback(Datum arg, int cacheid, uint32 hashvalue)
 {
-	pllua_cache_inval inval;
+	/*
+	 * Only TYPEOID hash values can be matched against typeinfos; for
+	 * transforms (TRFTYPELANG) the hash is of a different key, so
+	 * invalidate everything.
+	 */
+	if (cacheid != TYPEOID)
+		hashvalue = 0;
+
+	if (arg != (Datum) 0)
+	{
+		pllua_cache_inval inval;
 
-	memset(&inval, 0, sizeof(inval));
-	inval.inval_type = true;
-	inval.inval_typeoid = InvalidOid;
-	pllua_callback_broadcast(arg, pllua_register_cfunc(L, pllua_typeinfo_invalidate), &inval);
+		memset(&inval, 0, sizeof(inval));
+		inval.inval_type = true;
+		inval.inval_typhash = hashvalue;
+		pllua_apply_inval((pllua_interpreter *) DatumGetPointer(arg),
+						  pllua_register_cfunc(L, pllua_typeinfo_invalidate), &inval);
+		return;
+	}
+
+	pllua_type_inval_ring[pllua_type_generation % PLLUA_INVAL_RING_SIZE] = hashvalue;
+	++pllua_type_generation;
+	pllua_check_active_invalidations();
 }
 
 static void
 pllua_syscache_cast_callback(Datum arg, int cacheid, uint32 hashvalue)
 {
-	pllua_cache_inval inval;
+	if (arg != (Datum) 0)
+	{
+		pllua_cache_inval inval;
 
-	memset(&inval, 0, sizeof(inval));
-	inval.inval_cast = true;
-	pllua_callback_broadcast(arg, pllua_register_cfunc(L, pllua_typeconv_invalidate), &inval);
+		memset(&inval, 0, sizeof(inval));
+		inval.inval_cast = true;
+		pllua_apply_inval((pllua_interpreter *) DatumGetPointer(arg),
+						  pllua_register_cfunc(L, pllua_typeconv_invalidate), &inval);
+		return;
+	}
+
+	++pllua_cast_generation;
+	pllua_check_active_invalidations();
+}
+
+/*
+ * Lua heap allocation.
+ *
+ * By default we keep the actual lua data in the malloc heap (lua handles its
+ * own garbage collection), while associated objects (referenced by userdata
+ * values) go in the context associated with the interpreter.
+ *
+ * If pllua.context_allocator is on when the interpreter is created, the lua
+ * data instead goes in a "PL/Lua heap" child of the interpreter's context.
+ * AllocSet already does what we want here: small chunks are carved out of
+ * larger blocks and recycled through per-size-class freelists, so the many
+ * small lua objects don't fragment the malloc heap; the usage shows up in
+ * MemoryContextStats; and deleting the context along with the interpreter
+ * releases the blocks wholesale. There's no flag to have repalloc return null
+ * rather than throwing, so realloc is done as alloc, copy and free.
+ *
+ * Either way, we count the bytes and blocks currently held by lua.
+ *
+ * If pllua.max_interpreter_memory is set, we refuse to grow any block (or
+ * allocate a new one) that would take the interpreter over the limit. The
+ * limit covers both the lua heap and the interpreter's own memory context
+ * (where datum values, function info and so on live), though the latter is
+ * only remeasured occasionally since that means walking the whole context
+ * tree (and can't be measured at all on 9.5). Refusing the allocation makes lua
+ * (5.2 and later) run an emergency full GC and retry; if that still doesn't
+ * fit, lua raises a memory error, which becomes a pg error in the usual way.
+ */
+typedef struct pllua_heap
+{
+	MemoryContext cxt;			/* NULL if using malloc */
+	MemoryContext datacxt;		/* the interpreter's memory context */
+	size_t		nbytes;			/* bytes currently allocated to lua */
+	size_t		nblocks;		/* blocks currently allocated to lua */
+	size_t		databytes;		/* datacxt usage when last measured */
+	uint32		nchecks;		/* limit checks since last measured */
+	bool		limit_hit;		/* last failure was due to the limit */
+} pllua_heap;
+
+#define PLLUA_HEAP_REMEASURE_INTERVAL 256
+
+/*
+ * Total space allocated to cxt and its descendants, excluding the subtree
+ * rooted at "skip" (the lua heap, which we count separately).
+ */
+static size_t
+pllua_context_space(MemoryContext cxt, MemoryContext skip)
+{
+	size_t		total = 0;
+	MemoryContext child;
+
+	if (cxt == skip)
+		return 0;
+
+#if PG_VERSION_NUM >= 130000
+	total = MemoryContextMemAllocated(cxt, false);
+#elif PG_VERSION_NUM >= 90600
+	{
+		MemoryContextCounters counters;
+
+		memset(&counters, 0, sizeof(counters));
+#if PG_VERSION_NUM >= 110000
+		cxt->methods->stats(cxt, NULL, NULL, &counters);
+#else
+		cxt->methods->stats(cxt, 0, false, &counters);
+#endif
+		total = counters.totalspace;
+	}
+#endif
+
+	for (child = cxt->firstchild; child != NULL; child = child->nextchild)
+		total += pllua_context_space(child, skip);
+
+	return total;
+}
+
+static void
+pllua_heap_measure(pllua_heap *heap)
+{
+	heap->databytes = pllua_context_space(heap->datacxt, heap->cxt);
+	heap->nchecks = 0;
+}
+
+static bool
+pllua_heap_within_limit(pllua_heap *heap, size_t extra)
+{
+	size_t		limit = (size_t) pllua_max_interpreter_memory * 1024;
+
+	if (++heap->nchecks >= PLLUA_HEAP_REMEASURE_INTERVAL)
+		pllua_heap_measure(heap);
+	if (heap->nbytes + heap->databytes + extra <= limit)
+		return true;
+	/* don't fail on a stale measurement */
+	pllua_heap_measure(heap);
+	return (heap->nbytes + heap->databytes + extra <= limit);
+}
+
+/*
+ * Called when a lua memory error reaches pg: was it caused by the limit
+ * rather than a real malloc failure? Clears the indication.
+ */
+bool
+pllua_memory_limit_exceeded(lua_State *L)
+{
+#if LUA_VERSION_NUM > 501
+	void	   *ud;
+	pllua_heap *heap;
+	bool		result;
+
+	(void) lua_getallocf(L, &ud);
+	heap = ud;
+	if (!heap)
+		return false;
+	result = heap->limit_hit;
+	heap->limit_hit = false;
+	return result;
+#else
+	return false;
+#endif
 }
 
 /*
- * Would be nice to be able to use repalloc, but at present there is no flag to
- * have that return null rather than throwing. So for now, we keep the actual
- * lua data in the malloc heap (lua handles its own garbage collection), while
- * associated objects (referenced by userdata values) go in the context
- * associated with the interpreter. Lua's memory usage can be queried within
- * lua if one needs to monitor usage.
+ * pgtype.memory_stats()
+ *
+ * Returns a table describing the interpreter's memory use:
+ *   allocator = "malloc", "context" or "builtin" (lua's own, for 5.1/luajit)
+ *   lua_bytes = bytes currently allocated to the lua heap
+ *   lua_blocks = number of blocks in the lua heap (not for "builtin")
+ *   context_bytes = bytes in the interpreter's memory context, excluding
+ *                   the lua heap (0 on 9.5, where we can't measure it)
  */
+int
+pllua_memory_stats(lua_State *L)
+{
+	MemoryContext mcxt = pllua_get_memory_cxt(L);
+	MemoryContext skip = NULL;
+	volatile size_t cxtbytes = 0;
+#if LUA_VERSION_NUM > 501
+	void	   *ud;
+	pllua_heap *heap;
+
+	(void) lua_getallocf(L, &ud);
+	heap = ud;
+	skip = heap->cxt;
+#endif
+
+	PLLUA_TRY_NOSUBXACT();
+	{
+		cxtbytes = pllua_context_space(mcxt, skip);
+	}
+	PLLUA_CATCH_RETHROW();
+
+	lua_createtable(L, 0, 4);
+#if LUA_VERSION_NUM > 501
+	lua_pushstring(L, heap->cxt ? "context" : "malloc");
+	lua_setfield(L, -2, "allocator");
+	lua_pushinteger(L, (lua_Integer) heap->nbytes);
+	lua_setfield(L, -2, "lua_bytes");
+	lua_pushinteger(L, (lua_Integer) heap->nblocks);
+	lua_setfield(L, -2, "lua_blocks");
+#else
+	lua_pushstring(L, "builtin");
+	lua_setfield(L, -2, "allocator");
+	lua_pushinteger(L, (lua_Integer) lua_gc(L, LUA_GCCOUNT, 0) * 1024
+					+ lua_gc(L, LUA_GCCOUNTB, 0));
+	lua_setfield(L, -2, "lua_bytes");
+#endif
+	lua_pushinteger(L, (lua_Integer) cxtbytes);
+	lua_setfield(L, -2, "context_bytes");
+	return 1;
+}
+
+static void *
+pllua_heap_realloc(pllua_heap *heap, void *ptr, size_t osize, size_t nsize)
+{
+	void	   *nptr;
+
+	if (!heap->cxt)
+		return realloc(ptr, nsize);
+
+	nptr = MemoryContextAllocExtended(heap->cxt, nsize,
+									  MCXT_ALLOC_HUGE | MCXT_ALLOC_NO_OOM);
+	if (nptr && ptr)
+	{
+		memcpy(nptr, ptr, Min(osize, nsize));
+		pfree(ptr);
+	}
+	return nptr;
+}
+
 static void *
 pllua_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
 {
+	pllua_heap *heap = ud;
 	void	   *nptr;
 
-	(void)ud;  /* not used */
+	/* if ptr is null, osize is a type code rather than a size */
+	if (!ptr)
+		osize = 0;
 
 	if (nsize == 0)
 	{
-		free(ptr);							/* free(NULL) is explicitly safe */
+		if (ptr)
+		{
+			heap->nbytes -= osize;
+			heap->nblocks -= 1;
+			if (heap->cxt)
+				pfree(ptr);
+			else
+				free(ptr);
+		}
 		simulate_memory_failure = false;
 		return NULL;
 	}
 
 	if (simulate_memory_failure)
 		nptr = NULL;
+	else if (nsize > osize
+			 && pllua_max_interpreter_memory > 0
+			 && !pllua_ending
+			 && !pllua_heap_within_limit(heap, nsize - osize))
+	{
+		heap->limit_hit = true;
+		nptr = NULL;
+	}
 	else
-		nptr = realloc(ptr, nsize);
+		nptr = pllua_heap_realloc(heap, ptr, osize, nsize);
 
 	if (ptr && nsize < osize)
 	{
@@ -556,21 +961,41 @@ pllua_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
 		{
 			elog(WARNING, "pllua: failed to shrink a block of size %lu to %lu",
 				 (unsigned long) osize, (unsigned long) nsize);
-			return ptr;
+			nptr = ptr;
 		}
 	}
 
+	if (nptr)
+	{
+		if (nsize > osize)
+			heap->limit_hit = false;
+		heap->nbytes += nsize;
+		heap->nbytes -= osize;
+		if (!ptr)
+			heap->nblocks += 1;
+	}
+
 	return nptr;
 }
 
 /*
- * Hook function to check for interrupts. We have lua call this for every
- * function return or set number of opcodes executed.
+ * Hook function to check for interrupts. We have lua call this every so many
+ * opcodes executed (not on function returns, which would cost a setjmp per
+ * return in call-heavy code). Nearly always there is nothing pending, so test
+ * that first with a plain load and only set up the catch block when needed.
  */
 static void
 pllua_hook(lua_State *L, lua_Debug *ar)
 {
-	PLLUA_TRY();
+#if defined(INTERRUPTS_PENDING_CONDITION)
+	if (!INTERRUPTS_PENDING_CONDITION())
+		return;
+#elif !defined(WIN32)
+	if (!InterruptPending)
+		return;
+#endif
+
+	PLLUA_TRY_NOSUBXACT();
 	{
 		CHECK_FOR_INTERRUPTS();
 	}
@@ -722,8 +1147,14 @@ pllua_init_state_phase2(lua_State *L)
 
 	luaL_requiref(L, "pllua.numeric", pllua_open_numeric, 0);
 
+	luaL_requiref(L, "pllua.temporal", pllua_open_temporal, 0);
+
 	luaL_requiref(L, "pllua.jsonb", pllua_open_jsonb, 0);
 
+	luaL_requiref(L, "pllua.json", pllua_open_json, 0);
+
+	luaL_requiref(L, "pllua.hashmap", pllua_open_hashmap, 0);
+
 	/*
 	 * complete the initialization of the trusted-mode sandbox.
 	 * We do this in untrusted interps too, but for those, we don't
@@ -759,7 +1190,7 @@ pllua_init_state_phase2(lua_State *L)
 
 	/* enable interrupt checks */
 	if (pllua_do_check_for_interrupts)
-		lua_sethook(L, pllua_hook, LUA_MASKRET | LUA_MASKCOUNT, 100000);
+		lua_sethook(L, pllua_hook, LUA_MASKCOUNT, pllua_interrupt_check_interval);
 
 	/* don't run user code yet */
 	return 0;
@@ -810,6 +1241,9 @@ pllua_newstate_phase1(const char *ident)
 	MemoryContext	oldcontext = CurrentMemoryContext;
 	ErrorData	   *edata;
 	lua_State	   *L = NULL;
+#if LUA_VERSION_NUM > 501
+	pllua_heap	   *heap;
+#endif
 	int				rc;
 
 	ASSERT_PG_CONTEXT;
@@ -829,7 +1263,13 @@ pllua_newstate_phase1(const char *ident)
 #if LUA_VERSION_NUM == 501
 	L = luaL_newstate();
 #else
-	L = lua_newstate(pllua_alloc, NULL);
+	heap = palloc0(sizeof(pllua_heap));
+	heap->datacxt = mcxt;
+	if (pllua_context_allocator)
+		heap->cxt = AllocSetContextCreate(mcxt,
+										  "PL/Lua heap",
+										  ALLOCSET_DEFAULT_SIZES);
+	L = lua_newstate(pllua_alloc, heap);
 #endif
 
 	if (!L)
@@ -958,8 +1398,11 @@ pllua_newstate_phase2(lua_State *L,
 		 * force invalidation of the caches now anyway, since we might have
 		 * missed something (prior to the assignment above the invalidation
 		 * callbacks will ignore us); but for this interpreter only, no need to
-		 * involve any others.
+		 * involve any others. That covers everything queued so far.
 		 */
+		interp_desc->type_generation = pllua_type_generation;
+		interp_desc->rel_generation = pllua_rel_generation;
+		interp_desc->cast_generation = pllua_cast_generation;
 		pllua_relcache_callback(PointerGetDatum(interp_desc), InvalidOid);
 		pllua_syscache_typeoid_callback(PointerGetDatum(interp_desc), TYPEOID, 0);
 		pllua_syscache_cast_callback(PointerGetDatum(interp_desc), CASTSOURCETARGET, 0);
@@ -970,6 +1413,12 @@ pllua_newstate_phase2(lua_State *L,
 		 */
 		lua_pushcfunction(L, pllua_run_init_strings);
 		pllua_pcall(L, 0, 0, 0);
+
+		/*
+		 * And compile anything we were asked to have ready in advance.
+		 */
+		lua_pushcfunction(L, pllua_preload_function_list);
+		pllua_pcall(L, 0, 0, 0);
 	}
 	PG_CATCH();
 	{
@@ -0,0 +1,948 @@
+/* json.c */
+
+#include "pllua.h"
+
+#include "catalog/pg_type.h"
+#include "mb/pg_wchar.h"
+#include "utils/builtins.h"
+#include "utils/json.h"
+
+#include <math.h>
+
+/*
+ * Conversion between JSON text and Lua values.
+ *
+ * Values of type json arrive in Lua as strings, so the only alternatives
+ * would be a JSON library written in Lua or a round trip through jsonb. This
+ * module parses and generates the text directly. It follows the conventions
+ * of pllua.jsonb: decoded objects and arrays are tagged with the same
+ * metatables that jsonb mapping uses (so jsonb.is_object etc. work on them and
+ * they re-encode with the same shape), a configurable value stands for json
+ * null, and the array/object heuristics for untagged tables are the same.
+ *
+ * All the work here is done in Lua context; only building a json datum needs
+ * to enter PG.
+ */
+
+#define PLLUA_JSON_MAX_DEPTH 1000
+
+typedef struct pllua_json_dec
+{
+	lua_State  *L;
+	const char *str;
+	const char *ptr;
+	const char *end;
+	int			nullvalue;
+	bool		keep_numeric;
+	int			depth;
+} pllua_json_dec;
+
+typedef struct pllua_json_enc
+{
+	lua_State  *L;
+	int			bufidx;			/* stack slot holding the buffer userdata */
+	char	   *data;
+	size_t		len;
+	size_t		cap;
+	int			nullvalue;
+	bool		empty_object;
+	bool		sort_keys;
+	lua_Integer	array_thresh;
+	lua_Integer	array_frac;
+	int			depth;
+} pllua_json_enc;
+
+static void pllua_json_dec_value(pllua_json_dec *d);
+static void pllua_json_enc_value(pllua_json_enc *e, int nd);
+
+static void
+pllua_json_dec_error(pllua_json_dec *d, const char *msg)
+{
+	luaL_error(d->L, "invalid json at position %d: %s",
+			   (int) (d->ptr - d->str) + 1, msg);
+}
+
+static inline void
+pllua_json_dec_skipws(pllua_json_dec *d)
+{
+	while (d->ptr < d->end &&
+		   (*d->ptr == ' ' || *d->ptr == '\t' || *d->ptr == '\n' || *d->ptr == '\r'))
+		++d->ptr;
+}
+
+static void
+pllua_json_dec_literal(pllua_json_dec *d, const char *lit, size_t len)
+{
+	if ((size_t) (d->end - d->ptr) < len || memcmp(d->ptr, lit, len) != 0)
+		pllua_json_dec_error(d, "invalid token");
+	d->ptr += len;
+}
+
+static int
+pllua_json_dec_hex4(pllua_json_dec *d)
+{
+	int			val = 0;
+	int			i;
+
+	if (d->end - d->ptr < 4)
+		pllua_json_dec_error(d, "invalid unicode escape");
+	for (i = 0; i < 4; ++i)
+	{
+		char		c = *d->ptr++;
+
+		val <<= 4;
+		if (c >= '0' && c <= '9')
+			val += c - '0';
+		else if (c >= 'a' && c <= 'f')
+			val += c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F')
+			val += c - 'A' + 10;
+		else
+			pllua_json_dec_error(d, "invalid unicode escape");
+	}
+	return val;
+}
+
+static void
+pllua_json_dec_addutf8(pllua_json_dec *d, luaL_Buffer *b, pg_wchar cp)
+{
+	unsigned char buf[8];
+
+	if (cp > 0x7F && GetDatabaseEncoding() != PG_UTF8)
+		pllua_json_dec_error(d, "unicode escape values above 007F require UTF8 server encoding");
+	unicode_to_utf8(cp, buf);
+	luaL_addlstring(b, (const char *) buf, pg_utf_mblen(buf));
+}
+
+/*
+ * Push the string starting at the opening quote.
+ */
+static void
+pllua_json_dec_string(pllua_json_dec *d)
+{
+	lua_State  *L = d->L;
+	const char *start = ++d->ptr;
+	luaL_Buffer b;
+
+	/* fast path: no escapes */
+	while (d->ptr < d->end)
+	{
+		unsigned char c = (unsigned char) *d->ptr;
+
+		if (c == '"')
+		{
+			lua_pushlstring(L, start, d->ptr - start);
+			++d->ptr;
+			return;
+		}
+		if (c == '\\')
+			break;
+		if (c < 0x20)
+			pllua_json_dec_error(d, "control character in string");
+		++d->ptr;
+	}
+
+	luaL_buffinit(L, &b);
+	luaL_addlstring(&b, start, d->ptr - start);
+
+	while (d->ptr < d->end)
+	{
+		unsigned char c = (unsigned char) *d->ptr++;
+
+		if (c == '"')
+		{
+			luaL_pushresult(&b);
+			return;
+		}
+		else if (c < 0x20)
+		{
+			--d->ptr;
+			pllua_json_dec_error(d, "control character in string");
+		}
+		else if (c != '\\')
+		{
+			luaL_addchar(&b, c);
+			continue;
+		}
+
+		if (d->ptr >= d->end)
+			break;
+
+		switch (*d->ptr++)
+		{
+			case '"':	luaL_addchar(&b, '"');	break;
+			case '\\':	luaL_addchar(&b, '\\');	break;
+			case '/':	luaL_addchar(&b, '/');	break;
+			case 'b':	luaL_addchar(&b, '\b');	break;
+			case 'f':	luaL_addchar(&b, '\f');	break;
+			case 'n':	luaL_addchar(&b, '\n');	break;
+			case 'r':	luaL_addchar(&b, '\r');	break;
+			case 't':	luaL_addchar(&b, '\t');	break;
+			case 'u':
+				{
+					pg_wchar	cp = pllua_json_dec_hex4(d);
+
+					if (cp >= 0xDC00 && cp <= 0xDFFF)
+						pllua_json_dec_error(d, "unpaired unicode surrogate");
+					if (cp >= 0xD800 && cp <= 0xDBFF)
+					{
+						pg_wchar	lo;
+
+						if (d->end - d->ptr < 2 || d->ptr[0] != '\\' || d->ptr[1] != 'u')
+							pllua_json_dec_error(d, "unpaired unicode surrogate");
+						d->ptr += 2;
+						lo = pllua_json_dec_hex4(d);
+						if (lo < 0xDC00 || lo > 0xDFFF)
+							pllua_json_dec_error(d, "unpaired unicode surrogate");
+						cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+					}
+					pllua_json_dec_addutf8(d, &b, cp);
+				}
+				break;
+			default:
+				--d->ptr;
+				pllua_json_dec_error(d, "invalid escape sequence");
+		}
+	}
+
+	pllua_json_dec_error(d, "unterminated string");
+}
+
+/*
+ * Numbers are checked against the JSON grammar here, and then converted
+ * either by Lua (giving an integer if the value is integral and fits) or to a
+ * numeric datum. Upvalue 2 is pgtype.numeric.
+ */
+static void
+pllua_json_dec_number(pllua_json_dec *d)
+{
+	lua_State  *L = d->L;
+	const char *start = d->ptr;
+
+	if (*d->ptr == '-')
+		++d->ptr;
+	if (d->ptr < d->end && *d->ptr == '0')
+		++d->ptr;
+	else if (d->ptr < d->end && *d->ptr >= '1' && *d->ptr <= '9')
+	{
+		while (d->ptr < d->end && isdigit((unsigned char) *d->ptr))
+			++d->ptr;
+	}
+	else
+		pllua_json_dec_error(d, "invalid number");
+
+	if (d->ptr < d->end && *d->ptr == '.')
+	{
+		++d->ptr;
+		if (d->ptr >= d->end || !isdigit((unsigned char) *d->ptr))
+			pllua_json_dec_error(d, "invalid number");
+		while (d->ptr < d->end && isdigit((unsigned char) *d->ptr))
+			++d->ptr;
+	}
+	if (d->ptr < d->end && (*d->ptr == 'e' || *d->ptr == 'E'))
+	{
+		++d->ptr;
+		if (d->ptr < d->end && (*d->ptr == '+' || *d->ptr == '-'))
+			++d->ptr;
+		if (d->ptr >= d->end || !isdigit((unsigned char) *d->ptr))
+			pllua_json_dec_error(d, "invalid number");
+		while (d->ptr < d->end && isdigit((unsigned char) *d->ptr))
+			++d->ptr;
+	}
+
+	if (d->keep_numeric)
+	{
+		lua_pushvalue(L, lua_upvalueindex(2));
+		lua_pushlstring(L, start, d->ptr - start);
+		lua_call(L, 1, 1);
+	}
+	else
+	{
+		lua_pushlstring(L, start, d->ptr - start);
+		if (lua_stringtonumber(L, lua_tostring(L, -1)) == 0)
+			pllua_json_dec_error(d, "invalid number");
+		lua_remove(L, -2);
+	}
+}
+
+static void
+pllua_json_dec_container(pllua_json_dec *d, bool is_object)
+{
+	lua_State  *L = d->L;
+	char		close = is_object ? '}' : ']';
+	lua_Integer	i = 0;
+
+	if (++d->depth > PLLUA_JSON_MAX_DEPTH)
+		pllua_json_dec_error(d, "nesting too deep");
+	luaL_checkstack(L, 10, NULL);
+
+	++d->ptr;
+	lua_newtable(L);
+	lua_rawgetp(L, LUA_REGISTRYINDEX,
+				is_object ? PLLUA_JSON_OBJECT_MT : PLLUA_JSON_ARRAY_MT);
+	lua_setmetatable(L, -2);
+
+	pllua_json_dec_skipws(d);
+	if (d->ptr < d->end && *d->ptr == close)
+	{
+		++d->ptr;
+		--d->depth;
+		return;
+	}
+
+	for (;;)
+	{
+		if (is_object)
+		{
+			pllua_json_dec_skipws(d);
+			if (d->ptr >= d->end || *d->ptr != '"')
+				pllua_json_dec_error(d, "expected string key");
+			pllua_json_dec_string(d);
+			pllua_json_dec_skipws(d);
+			if (d->ptr >= d->end || *d->ptr != ':')
+				pllua_json_dec_error(d, "expected ':'");
+			++d->ptr;
+			pllua_json_dec_value(d);
+			lua_rawset(L, -3);
+		}
+		else
+		{
+			pllua_json_dec_value(d);
+			lua_rawseti(L, -2, ++i);
+		}
+
+		pllua_json_dec_skipws(d);
+		if (d->ptr < d->end && *d->ptr == ',')
+			++d->ptr;
+		else if (d->ptr < d->end && *d->ptr == close)
+		{
+			++d->ptr;
+			break;
+		}
+		else
+			pllua_json_dec_error(d, is_object ? "expected ',' or '}'" : "expected ',' or ']'");
+	}
+
+	--d->depth;
+}
+
+static void
+pllua_json_dec_value(pllua_json_dec *d)
+{
+	pllua_json_dec_skipws(d);
+	if (d->ptr >= d->end)
+		pllua_json_dec_error(d, "unexpected end of input");
+
+	switch (*d->ptr)
+	{
+		case '{':
+			pllua_json_dec_container(d, true);
+			break;
+		case '[':
+			pllua_json_dec_container(d, false);
+			break;
+		case '"':
+			pllua_json_dec_string(d);
+			break;
+		case 't':
+			pllua_json_dec_literal(d, "true", 4);
+			lua_pushboolean(d->L, 1);
+			break;
+		case 'f':
+			pllua_json_dec_literal(d, "false", 5);
+			lua_pushboolean(d->L, 0);
+			break;
+		case 'n':
+			pllua_json_dec_literal(d, "null", 4);
+			lua_pushvalue(d->L, d->nullvalue);
+			break;
+		case '-':
+		case '0': case '1': case '2': case '3': case '4':
+		case '5': case '6': case '7': case '8': case '9':
+			pllua_json_dec_number(d);
+			break;
+		default:
+			pllua_json_dec_error(d, "unexpected character");
+	}
+}
+
+/*
+ * json.decode(str [, config])
+ *
+ * config keys:
+ *  - null = (any value)
+ *  - pg_numeric = (boolean)
+ */
+static int
+pllua_json_decode(lua_State *L)
+{
+	pllua_json_dec d;
+	size_t		len = 0;
+
+	lua_settop(L, 2);
+	if (lua_type(L, 1) == LUA_TSTRING)
+		d.str = lua_tolstring(L, 1, &len);
+	else
+	{
+		d.str = luaL_tolstring(L, 1, &len);
+		lua_replace(L, 1);
+	}
+
+	d.L = L;
+	d.ptr = d.str;
+	d.end = d.str + len;
+	d.keep_numeric = false;
+	d.depth = 0;
+
+	if (lua_istable(L, 2))
+	{
+		lua_getfield(L, 2, "pg_numeric");
+		d.keep_numeric = lua_toboolean(L, -1);
+		lua_pop(L, 1);
+		lua_getfield(L, 2, "null");
+		d.nullvalue = lua_absindex(L, -1);
+	}
+	else
+	{
+		lua_pushnil(L);
+		d.nullvalue = lua_absindex(L, -1);
+	}
+
+	pllua_json_dec_value(&d);
+	pllua_json_dec_skipws(&d);
+	if (d.ptr != d.end)
+		pllua_json_dec_error(&d, "unexpected data after end of value");
+
+	return 1;
+}
+
+
+/*
+ * Output is accumulated in a Lua userdata at a fixed stack slot, replaced by
+ * a larger one as needed. (A luaL_Buffer won't do, since we need the stack
+ * for iteration state in between additions.)
+ */
+static void
+pllua_json_enc_reserve(pllua_json_enc *e, size_t n)
+{
+	if (e->len + n > e->cap)
+	{
+		size_t		newcap = Max(e->cap * 2, e->len + n);
+		char	   *newdata = lua_newuserdata(e->L, newcap);
+
+		if (e->len)
+			memcpy(newdata, e->data, e->len);
+		lua_replace(e->L, e->bufidx);
+		e->data = newdata;
+		e->cap = newcap;
+	}
+}
+
+static inline void
+pllua_json_enc_add(pllua_json_enc *e, const char *str, size_t len)
+{
+	pllua_json_enc_reserve(e, len);
+	memcpy(e->data + e->len, str, len);
+	e->len += len;
+}
+
+static inline void
+pllua_json_enc_addchar(pllua_json_enc *e, char c)
+{
+	pllua_json_enc_reserve(e, 1);
+	e->data[e->len++] = c;
+}
+
+/*
+ * Lua's own conversion of floats uses only 14 digits, which loses precision
+ * (0.1+0.2 would come out as 0.3). Use the shortest %g form that reads back
+ * as the same value; 17 digits always suffice for a double.
+ */
+static void
+pllua_json_enc_float(pllua_json_enc *e, lua_Number n)
+{
+	char		buf[32];
+	int			prec;
+	int			len = 0;
+
+	if (!isfinite(n))
+		luaL_error(e->L, "cannot serialize non-finite number");
+
+	for (prec = 15; prec <= 17; ++prec)
+	{
+		len = snprintf(buf, sizeof(buf), "%.*g", prec, (double) n);
+		if (strtod(buf, NULL) == (double) n)
+			break;
+	}
+	pllua_json_enc_add(e, buf, len);
+}
+
+static void
+pllua_json_enc_string(pllua_json_enc *e, const char *str, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	const char *run = str;
+	const char *end = str + len;
+	const char *p;
+
+	pllua_json_enc_addchar(e, '"');
+	for (p = str; p < end; ++p)
+	{
+		unsigned char c = (unsigned char) *p;
+		char		esc[8];
+		int			esclen = 2;
+
+		if (c >= 0x20 && c != '"' && c != '\\')
+			continue;
+
+		esc[0] = '\\';
+		switch (c)
+		{
+			case '"':	esc[1] = '"';	break;
+			case '\\':	esc[1] = '\\';	break;
+			case '\b':	esc[1] = 'b';	break;
+			case '\f':	esc[1] = 'f';	break;
+			case '\n':	esc[1] = 'n';	break;
+			case '\r':	esc[1] = 'r';	break;
+			case '\t':	esc[1] = 't';	break;
+			default:
+				esc[1] = 'u';
+				esc[2] = '0';
+				esc[3] = '0';
+				esc[4] = hex[c >> 4];
+				esc[5] = hex[c & 15];
+				esclen = 6;
+				break;
+		}
+		pllua_json_enc_add(e, run, p - run);
+		pllua_json_enc_add(e, esc, esclen);
+		run = p + 1;
+	}
+	pllua_json_enc_add(e, run, end - run);
+	pllua_json_enc_addchar(e, '"');
+}
+
+/*
+ * Push the string form of the key at nd.
+ */
+static const char *
+pllua_json_enc_pushkey(lua_State *L, int nd, size_t *len)
+{
+	switch (lua_type(L, nd))
+	{
+		case LUA_TSTRING:
+		case LUA_TNUMBER:
+			lua_pushvalue(L, nd);
+			return lua_tolstring(L, -1, len);  /* alters stack value as side effect */
+		case LUA_TUSERDATA:
+		case LUA_TTABLE:
+			if (luaL_getmetafield(L, nd, "__tostring") == LUA_TNIL)
+				luaL_error(L, "cannot serialize userdata or table which lacks __tostring as a key");
+			lua_pop(L, 1);
+			return luaL_tolstring(L, nd, len);
+		default:
+			luaL_error(L, "cannot serialize scalar value of type %s as key", luaL_typename(L, nd));
+	}
+	return NULL;
+}
+
+/*
+ * Objects and arrays. We need one pass over the keys to decide which this
+ * is (unless it's tagged), and a second to emit the contents. If sort_keys is
+ * set, the first pass also collects the stringified keys and the values so
+ * that the second pass can work from those.
+ */
+static void
+pllua_json_enc_container(pllua_json_enc *e, int nd)
+{
+	lua_State  *L = e->L;
+	lua_Integer	min_intkey = LUA_MAXINTEGER;
+	lua_Integer	max_intkey = 0;
+	lua_Integer	numkeys = 0;
+	lua_Integer	numintkeys = 0;
+	int			keytab = 0;
+	int			valtab = 0;
+	bool		known_object = false;
+	bool		known_array = false;
+	bool		is_object;
+	bool		metaloop;
+	bool		first = true;
+
+	if (++e->depth > PLLUA_JSON_MAX_DEPTH)
+		luaL_error(L, "json nesting too deep (possible reference cycle)");
+	luaL_checkstack(L, 20, NULL);
+
+	switch (luaL_getmetafield(L, nd, "__jsonb_object"))
+	{
+		case LUA_TBOOLEAN:
+			if (lua_toboolean(L, -1))
+				known_object = true;
+			else
+				known_array = true;
+			/* FALLTHROUGH */
+		default:
+			lua_pop(L, 1);
+			break;
+		case LUA_TNIL:
+			break;
+	}
+
+	if (e->sort_keys && !known_array)
+	{
+		lua_newtable(L);
+		keytab = lua_gettop(L);
+		lua_newtable(L);
+		valtab = lua_gettop(L);
+	}
+
+	metaloop = pllua_pairs_start(L, nd, true);
+	/* stack: [iter, state,] key */
+	while (metaloop ? pllua_pairs_next(L) : lua_next(L, nd))
+	{
+		++numkeys;
+		if (lua_isinteger(L, -2))
+		{
+			lua_Integer	k = lua_tointeger(L, -2);
+			if (k > max_intkey)
+				max_intkey = k;
+			if (k < min_intkey)
+				min_intkey = k;
+			++numintkeys;
+		}
+		if (keytab)
+		{
+			size_t		len;
+
+			pllua_json_enc_pushkey(L, lua_absindex(L, -2), &len);
+			lua_pushvalue(L, -1);
+			lua_rawseti(L, keytab, numkeys);
+			lua_insert(L, -2);
+			lua_rawset(L, valtab);
+		}
+		else
+			lua_pop(L, 1);
+	}
+
+	if (known_object
+		|| (!known_array
+			&& ((e->empty_object && numkeys == 0)
+				|| (numkeys != numintkeys)
+				|| (min_intkey < 1)
+				|| (numintkeys > 0 && min_intkey > e->array_thresh)
+				|| (numintkeys > 0 && max_intkey > e->array_frac * numkeys))))
+		is_object = true;
+	else
+		is_object = false;
+
+	if (!is_object)
+	{
+		lua_Integer	i;
+
+		pllua_json_enc_addchar(e, '[');
+		for (i = 1; i <= max_intkey; ++i)
+		{
+			if (i > 1)
+				pllua_json_enc_addchar(e, ',');
+			lua_geti(L, nd, i);
+			pllua_json_enc_value(e, lua_gettop(L));
+			lua_pop(L, 1);
+		}
+		pllua_json_enc_addchar(e, ']');
+	}
+	else if (keytab)
+	{
+		lua_Integer	i;
+
+		lua_pushvalue(L, lua_upvalueindex(3));
+		lua_pushvalue(L, keytab);
+		lua_call(L, 1, 0);
+
+		pllua_json_enc_addchar(e, '{');
+		for (i = 1; i <= numkeys; ++i)
+		{
+			const char *str;
+			size_t		len;
+
+			if (!first)
+				pllua_json_enc_addchar(e, ',');
+			first = false;
+			lua_rawgeti(L, keytab, i);
+			str = lua_tolstring(L, -1, &len);
+			pllua_json_enc_string(e, str, len);
+			pllua_json_enc_addchar(e, ':');
+			lua_rawget(L, valtab);
+			pllua_json_enc_value(e, lua_gettop(L));
+			lua_pop(L, 1);
+		}
+		pllua_json_enc_addchar(e, '}');
+	}
+	else
+	{
+		pllua_json_enc_addchar(e, '{');
+		metaloop = pllua_pairs_start(L, nd, true);
+		while (metaloop ? pllua_pairs_next(L) : lua_next(L, nd))
+		{
+			const char *str;
+			size_t		len;
+
+			if (!first)
+				pllua_json_enc_addchar(e, ',');
+			first = false;
+			str = pllua_json_enc_pushkey(L, lua_absindex(L, -2), &len);
+			pllua_json_enc_string(e, str, len);
+			lua_pop(L, 1);
+			pllua_json_enc_addchar(e, ':');
+			pllua_json_enc_value(e, lua_gettop(L));
+			lua_pop(L, 1);
+		}
+		pllua_json_enc_addchar(e, '}');
+	}
+
+	if (keytab)
+		lua_settop(L, keytab - 1);
+
+	--e->depth;
+}
+
+static void
+pllua_json_enc_value(pllua_json_enc *e, int nd)
+{
+	lua_State  *L = e->L;
+	pllua_typeinfo *dt;
+	const char *str;
+	size_t		len;
+
+	if (lua_rawequal(L, nd, e->nullvalue))
+	{
+		pllua_json_enc_add(e, "null", 4);
+		return;
+	}
+
+	switch (lua_type(L, nd))
+	{
+		case LUA_TNIL:
+			pllua_json_enc_add(e, "null", 4);
+			return;
+
+		case LUA_TBOOLEAN:
+			if (lua_toboolean(L, nd))
+				pllua_json_enc_add(e, "true", 4);
+			else
+				pllua_json_enc_add(e, "false", 5);
+			return;
+
+		case LUA_TNUMBER:
+			if (lua_isinteger(L, nd))
+			{
+				lua_pushvalue(L, nd);
+				str = lua_tolstring(L, -1, &len);
+				pllua_json_enc_add(e, str, len);
+				lua_pop(L, 1);
+			}
+			else
+				pllua_json_enc_float(e, lua_tonumber(L, nd));
+			return;
+
+		case LUA_TSTRING:
+			str = lua_tolstring(L, nd, &len);
+			pllua_json_enc_string(e, str, len);
+			return;
+
+		case LUA_TUSERDATA:
+			if (pllua_toanydatum(L, nd, &dt))
+			{
+				Oid			typeoid = dt->basetype;
+
+				lua_pop(L, 1);
+				if (typeoid == NUMERICOID || typeoid == JSONOID || typeoid == JSONBOID)
+				{
+					str = luaL_tolstring(L, nd, &len);
+					/* NaN and Infinity are the only numeric outputs not starting with a digit */
+					if (typeoid == NUMERICOID
+						&& !isdigit((unsigned char) str[(str[0] == '-') ? 1 : 0]))
+						luaL_error(L, "cannot serialize non-finite numeric");
+					pllua_json_enc_add(e, str, len);
+					lua_pop(L, 1);
+					return;
+				}
+				if (!pllua_is_container(L, nd))
+				{
+					str = luaL_tolstring(L, nd, &len);
+					pllua_json_enc_string(e, str, len);
+					lua_pop(L, 1);
+					return;
+				}
+			}
+			else if (pllua_toobject(L, nd, PLLUA_JSONB_PROXY_OBJECT))
+			{
+				str = luaL_tolstring(L, nd, &len);
+				pllua_json_enc_add(e, str, len);
+				lua_pop(L, 1);
+				return;
+			}
+			/* FALLTHROUGH */
+		case LUA_TTABLE:
+			if (pllua_is_container(L, nd))
+			{
+				pllua_json_enc_container(e, nd);
+				return;
+			}
+			if (luaL_getmetafield(L, nd, "__tostring") == LUA_TNIL)
+				luaL_error(L, "cannot serialize userdata which lacks both __pairs and __tostring");
+			lua_pop(L, 1);
+			str = luaL_tolstring(L, nd, &len);
+			pllua_json_enc_string(e, str, len);
+			lua_pop(L, 1);
+			return;
+
+		default:
+			luaL_error(L, "cannot serialize scalar value of type %s", luaL_typename(L, nd));
+	}
+}
+
+/*
+ * Encode the value at index 1 with config at index 2, leaving the buffer
+ * userdata on the stack.
+ *
+ * config keys:
+ *  - null = (any value)
+ *  - empty_object = (boolean)
+ *  - array_thresh = (integer)
+ *  - array_frac = (integer)
+ *  - sort_keys = (boolean)
+ *
+ * Upvalue 3 is table.sort.
+ */
+static void
+pllua_json_encode_guts(lua_State *L, pllua_json_enc *e)
+{
+	lua_settop(L, 2);
+
+	e->L = L;
+	e->empty_object = false;
+	e->sort_keys = false;
+	e->array_thresh = 1000;
+	e->array_frac = 1000;
+	e->depth = 0;
+
+	if (lua_istable(L, 2))
+	{
+		lua_getfield(L, 2, "empty_object");
+		e->empty_object = lua_toboolean(L, -1);
+		lua_pop(L, 1);
+		lua_getfield(L, 2, "sort_keys");
+		e->sort_keys = lua_toboolean(L, -1);
+		lua_pop(L, 1);
+		lua_getfield(L, 2, "array_thresh");
+		if (lua_isinteger(L, -1))
+			e->array_thresh = lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		lua_getfield(L, 2, "array_frac");
+		if (lua_isinteger(L, -1))
+			e->array_frac = lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		lua_getfield(L, 2, "null");
+	}
+	else
+		lua_pushnil(L);
+	e->nullvalue = lua_absindex(L, -1);
+
+	e->cap = 256;
+	e->len = 0;
+	e->data = lua_newuserdata(L, e->cap);
+	e->bufidx = lua_absindex(L, -1);
+
+	pllua_json_enc_value(e, 1);
+	lua_settop(L, e->bufidx);
+}
+
+/*
+ * json.encode(value [, config])  returns a string
+ */
+static int
+pllua_json_encode(lua_State *L)
+{
+	pllua_json_enc e;
+
+	pllua_json_encode_guts(L, &e);
+	lua_pushlstring(L, e.data, e.len);
+	return 1;
+}
+
+/*
+ * json.todatum(value [, config])  returns a datum of type json
+ *
+ * Upvalue 1 is pgtype.json.
+ */
+static int
+pllua_json_todatum(lua_State *L)
+{
+	pllua_typeinfo *t = *pllua_torefobject(L, lua_upvalueindex(1), PLLUA_TYPEINFO_OBJECT);
+	pllua_json_enc e;
+	pllua_datum *d;
+
+	pllua_json_encode_guts(L, &e);
+	d = pllua_newdatum(L, lua_upvalueindex(1), (Datum)0);
+
+	PLLUA_TRY();
+	{
+		MemoryContext oldcontext;
+		char	   *str;
+		text	   *txt;
+
+		/*
+		 * Values of json-ish types are copied in as-is, so run the result
+		 * through json_in to be sure we never build an invalid datum.
+		 */
+		pg_verifymbstr(e.data, e.len, false);
+		str = pnstrdup(e.data, e.len);
+		txt = DatumGetTextPP(DirectFunctionCall1(json_in, CStringGetDatum(str)));
+		pfree(str);
+		oldcontext = MemoryContextSwitchTo(pllua_get_memory_cxt(L));
+		d->value = PointerGetDatum(txt);
+		pllua_savedatum(L, d, t);
+		MemoryContextSwitchTo(oldcontext);
+		pfree(txt);
+	}
+	PLLUA_CATCH_RETHROW();
+
+	return 1;
+}
+
+static luaL_Reg json_funcs[] = {
+	{ "decode", pllua_json_decode },
+	{ "encode", pllua_json_encode },
+	{ "todatum", pllua_json_todatum },
+	{ NULL, NULL }
+};
+
+int pllua_open_json(lua_State *L)
+{
+	lua_settop(L, 0);
+
+	if (lua_rawgetp(L, LUA_REGISTRYINDEX, PLLUA_JSON_OBJECT_MT) != LUA_TTABLE)
+		luaL_error(L, "pllua.jsonb must be loaded before pllua.json");
+	lua_pop(L, 1);
+
+	lua_newtable(L);  /* module table at index 1 */
+
+	lua_pushcfunction(L, pllua_typeinfo_lookup);
+	lua_pushinteger(L, JSONOID);
+	lua_call(L, 1, 1);
+
+	lua_pushcfunction(L, pllua_typeinfo_lookup);
+	lua_pushinteger(L, NUMERICOID);
+	lua_call(L, 1, 1);
+
+	luaL_getsubtable(L, LUA_REGISTRYINDEX, "_LOADED");
+	if (lua_getfield(L, -1, "table") != LUA_TTABLE)
+		luaL_error(L, "table package is not loaded");
+	if (lua_getfield(L, -1, "sort") != LUA_TFUNCTION)
+		luaL_error(L, "table.sort function not found");
+	lua_remove(L, -2);
+	lua_remove(L, -2);
+
+	luaL_setfuncs(L, json_funcs, 3);
+
+	return 1;
+}
@@ -16,6 +16,53 @@
 #define DatumGetJsonbP(d_) DatumGetJsonb(d_)
 #endif
 
+#ifndef JsonContainerIsArray
+#define JsonContainerSize(jc)		((jc)->header & JB_CMASK)
+#define JsonContainerIsObject(jc)	(((jc)->header & JB_FOBJECT) != 0)
+#define JsonContainerIsArray(jc)	(((jc)->header & JB_FARRAY) != 0)
+#endif
+
+/*
+ * Lazy access to jsonb values.
+ *
+ * A proxy object refers to a single container (object or array) inside a
+ * jsonb datum, and looks up keys and elements directly in the binary
+ * representation on demand. Sub-containers are returned as further proxies
+ * pointing into the same storage, so reading one field of a large document
+ * never converts the rest of it.
+ *
+ * The proxy's uservalue holds either the original datum (for a top-level
+ * proxy) or the parent proxy (for a sub-container), which keeps the storage
+ * alive. If the datum had to be detoasted, the top-level proxy also owns the
+ * memory context holding the detoasted copy.
+ */
+typedef struct pllua_jsonb_proxy
+{
+	JsonbContainer *container;
+	uint32		len;
+	bool		keep_numeric;
+} pllua_jsonb_proxy;
+
+/*
+ * Iterator state, also used for proxies over objects. The iterator and all
+ * its substates live in mcxt; JsonbIteratorNext frees substates as it leaves
+ * them, so the memory used is bounded by the nesting depth.
+ */
+typedef struct pllua_jsonb_iter
+{
+	JsonbIterator *it;
+	MemoryContext mcxt;
+	int			depth;			/* nesting depth, for events only */
+	bool		raw_scalar;		/* top level is a scalar, for events only */
+} pllua_jsonb_iter;
+
+static bool
+pllua_jsonb_is_container(lua_State *L, int nd)
+{
+	return (pllua_is_container(L, nd) &&
+			!pllua_toobject(L, nd, PLLUA_JSONB_PROXY_OBJECT));
+}
+
 /*
  * called with the container value on top of the stack
  *
@@ -217,6 +264,7 @@ pllua_jsonb_toscalar(lua_State *L, JsonbValue *pval, MemoryContext tmpcxt)
 {
 	pllua_typeinfo *dt;
 	pllua_datum *d;
+	pllua_jsonb_proxy *p;
 
 	switch (lua_type(L, -1))
 	{
@@ -234,7 +282,15 @@ pllua_jsonb_toscalar(lua_State *L, JsonbValue *pval, MemoryContext tmpcxt)
 			lua_call(L, 1, 1);
 			/* FALLTHROUGH */
 		case LUA_TUSERDATA:
-			if ((d = pllua_todatum(L, -1, lua_upvalueindex(3))))
+			if ((p = pllua_toobject(L, -1, PLLUA_JSONB_PROXY_OBJECT)))
+			{
+				/* proxies are included directly, without conversion */
+				pval->type = jbvBinary;
+				pval->val.binary.data = p->container;
+				pval->val.binary.len = p->len;
+				return;
+			}
+			else if ((d = pllua_todatum(L, -1, lua_upvalueindex(3))))
 			{
 				pllua_typeinfo *dt = *pllua_torefobject(L, lua_upvalueindex(3), PLLUA_TYPEINFO_OBJECT);
 				pval->type = jbvNumeric;
@@ -289,6 +345,188 @@ pllua_jsonb_toscalar(lua_State *L, JsonbValue *pval, MemoryContext tmpcxt)
 	}
 }
 
+/*
+ * Single-pass builder used for trusted_shape mode.
+ *
+ * Here the caller promises that arrays are either marked as such or are
+ * plain sequences, so we can decide the container type up front rather than
+ * collecting and examining all the keys: arrays are read by index from 1 to
+ * #value, and objects with one pairs() loop. No key lists are built and
+ * nothing is sorted on our side.
+ *
+ * Called with the container value on top of the stack, which is popped.
+ * Returns the result of the final pushJsonbValue (only meaningful at top
+ * level).
+ */
+static JsonbValue *pllua_jsonb_build_trusted(lua_State *L, JsonbParseState **pstate,
+											 MemoryContext tmpcxt, int nullvalue,
+											 int funcidx, bool empty_object);
+
+/*
+ * Called with the (unmapped) element value on top of the stack, which is
+ * popped.
+ */
+static void
+pllua_jsonb_build_trusted_value(lua_State *L, JsonbParseState **pstate,
+								MemoryContext tmpcxt, int nullvalue,
+								int funcidx, bool empty_object,
+								JsonbIteratorToken tok)
+{
+	JsonbValue	curval;
+
+	if (lua_rawequal(L, -1, nullvalue))
+	{
+		lua_pushnil(L);
+		lua_replace(L, -2);
+	}
+	if (funcidx)
+	{
+		lua_pushvalue(L, funcidx);
+		lua_insert(L, -2);
+		lua_call(L, 1, 1);
+	}
+
+	if (pllua_jsonb_is_container(L, -1))
+	{
+		pllua_jsonb_build_trusted(L, pstate, tmpcxt, nullvalue, funcidx, empty_object);
+		return;
+	}
+
+	pllua_jsonb_toscalar(L, &curval, tmpcxt);
+
+	PLLUA_TRY();
+	{
+		MemoryContext oldcontext = MemoryContextSwitchTo(tmpcxt);
+		pushJsonbValue(pstate, tok, &curval);
+		MemoryContextSwitchTo(oldcontext);
+	}
+	PLLUA_CATCH_RETHROW();
+
+	lua_pop(L, 1);
+}
+
+static JsonbValue *
+pllua_jsonb_build_trusted(lua_State *L, JsonbParseState **pstate,
+						  MemoryContext tmpcxt, int nullvalue,
+						  int funcidx, bool empty_object)
+{
+	int			cidx = lua_absindex(L, -1);
+	bool		is_array = false;
+	lua_Integer	n = 0;
+	JsonbValue *volatile result = NULL;
+
+	luaL_checkstack(L, 20, NULL);
+
+	switch (luaL_getmetafield(L, cidx, "__jsonb_object"))
+	{
+		case LUA_TBOOLEAN:
+			is_array = !lua_toboolean(L, -1);
+			lua_pop(L, 1);
+			if (is_array)
+				n = luaL_len(L, cidx);
+			break;
+		case LUA_TNIL:
+			if (lua_type(L, cidx) != LUA_TTABLE)
+				break;
+			if (luaL_getmetafield(L, cidx, "__pairs") != LUA_TNIL)
+			{
+				lua_pop(L, 1);
+				break;
+			}
+			n = lua_rawlen(L, cidx);
+			if (n > 0)
+				is_array = true;
+			else
+			{
+				lua_pushnil(L);
+				if (lua_next(L, cidx))
+					lua_pop(L, 2);
+				else
+					is_array = !empty_object;
+			}
+			break;
+		default:
+			lua_pop(L, 1);
+			break;
+	}
+
+	PLLUA_TRY();
+	{
+		MemoryContext oldcontext = MemoryContextSwitchTo(tmpcxt);
+		check_stack_depth();
+		pushJsonbValue(pstate, is_array ? WJB_BEGIN_ARRAY : WJB_BEGIN_OBJECT, NULL);
+		MemoryContextSwitchTo(oldcontext);
+	}
+	PLLUA_CATCH_RETHROW();
+
+	if (is_array)
+	{
+		lua_Integer i;
+
+		for (i = 1; i <= n; ++i)
+		{
+			lua_geti(L, cidx, i);
+			pllua_jsonb_build_trusted_value(L, pstate, tmpcxt, nullvalue,
+											funcidx, empty_object, WJB_ELEM);
+		}
+	}
+	else
+	{
+		bool		metaloop = pllua_pairs_start(L, cidx, true);
+
+		/* stack: [iter, state,] key */
+		while (metaloop ? pllua_pairs_next(L) : lua_next(L, cidx))
+		{
+			JsonbValue	keyval;
+
+			switch (lua_type(L, -2))
+			{
+				case LUA_TSTRING:
+					lua_pushvalue(L, -2);
+					break;
+				case LUA_TNUMBER:
+					lua_pushvalue(L, -2);
+					lua_tostring(L, -1);  /* alters stack value as side effect */
+					break;
+				default:
+					luaL_error(L, "cannot serialize value of type %s as key", luaL_typename(L, -2));
+			}
+
+			PLLUA_TRY();
+			{
+				size_t		len = 0;
+				const char *ptr = lua_tolstring(L, -1, &len);
+				MemoryContext oldcontext = MemoryContextSwitchTo(tmpcxt);
+
+				keyval.type = jbvString;
+				keyval.val.string.val = palloc(len);
+				keyval.val.string.len = len;
+				memcpy(keyval.val.string.val, ptr, len);
+				pg_verifymbstr(keyval.val.string.val, len, false);
+				pushJsonbValue(pstate, WJB_KEY, &keyval);
+				MemoryContextSwitchTo(oldcontext);
+			}
+			PLLUA_CATCH_RETHROW();
+
+			lua_pop(L, 1);
+			/* stack: [iter, state,] key value */
+			pllua_jsonb_build_trusted_value(L, pstate, tmpcxt, nullvalue,
+											funcidx, empty_object, WJB_VALUE);
+		}
+	}
+
+	PLLUA_TRY();
+	{
+		MemoryContext oldcontext = MemoryContextSwitchTo(tmpcxt);
+		result = pushJsonbValue(pstate, is_array ? WJB_END_ARRAY : WJB_END_OBJECT, NULL);
+		MemoryContextSwitchTo(oldcontext);
+	}
+	PLLUA_CATCH_RETHROW();
+
+	lua_settop(L, cidx - 1);
+	return result;
+}
+
 /*
  * Called as tosql(table, config)
  *
@@ -296,6 +534,7 @@ pllua_jsonb_toscalar(lua_State *L, JsonbValue *pval, MemoryContext tmpcxt)
  *  - mapfunc
  *  - empty_object = (boolean)
  *  - nullvalue = (any value)
+ *  - trusted_shape = (boolean)
  *
  * Anything raw-equal to the nullvalue is taken as being a json null.
  */
@@ -309,6 +548,7 @@ pllua_jsonb_tosql(lua_State *L)
 	int funcidx = 0;
 	int array_thresh = 1000;
 	int array_frac = 1000;
+	bool trusted_shape = false;
 	JsonbParseState *pstate = NULL;
 	JsonbValue nullval;
 	JsonbValue curval;
@@ -356,6 +596,10 @@ pllua_jsonb_tosql(lua_State *L)
 		if (lua_isinteger(L, -1))
 			array_frac = lua_tointeger(L, -1);
 		lua_pop(L, 1);
+		if (lua_getfield(L, 2, "trusted_shape") &&
+			lua_toboolean(L, -1))
+			trusted_shape = true;
+		lua_pop(L, 1);
 		lua_getfield(L, 2, "null");
 		nullvalue = lua_absindex(L, -1);
 	}
@@ -376,7 +620,7 @@ pllua_jsonb_tosql(lua_State *L)
 		lua_replace(L, 1);
 	}
 
-	if (!pllua_is_container(L, 1))
+	if (!pllua_jsonb_is_container(L, 1))
 	{
 		JsonbValue sval;
 
@@ -392,6 +636,21 @@ pllua_jsonb_tosql(lua_State *L)
 		}
 		PLLUA_CATCH_RETHROW();
 	}
+	else if (trusted_shape)
+	{
+		lua_pushvalue(L, 1);
+
+		result = pllua_jsonb_build_trusted(L, &pstate, tmpcxt, nullvalue,
+										   funcidx, empty_object);
+
+		PLLUA_TRY();
+		{
+			MemoryContext oldcontext = MemoryContextSwitchTo(tmpcxt);
+			datum = PointerGetDatum(JsonbValueToJsonb(result));
+			MemoryContextSwitchTo(oldcontext);
+		}
+		PLLUA_CATCH_RETHROW();
+	}
 	else
 	{
 		JsonbIteratorToken tok;
@@ -510,7 +769,7 @@ pllua_jsonb_tosql(lua_State *L)
 					lua_call(L, 1, 1);
 				}
 
-				if (pllua_is_container(L, -1))
+				if (pllua_jsonb_is_container(L, -1))
 				{
 					tok = pllua_jsonb_pushkeys(L, empty_object, array_thresh, array_frac);
 					/* stack: ... value=newcontainer newkeylist newprevkey newindex */
@@ -811,7 +1070,7 @@ pllua_jsonb_map(lua_State *L)
 		}
 	}
 
-	PLLUA_TRY();
+	PLLUA_TRY_NOSUBXACT();
 	{
 		if ((Pointer)jb != DatumGetPointer(d->value))
 			pfree(jb);
@@ -821,105 +1080,899 @@ pllua_jsonb_map(lua_State *L)
 	return noresult ? 0 : 1;
 }
 
-static luaL_Reg jsonb_meta[] = {
-	{ "__call", pllua_jsonb_map },
-	{ "tosql", pllua_jsonb_tosql },
-	{ NULL, NULL }
-};
+static pllua_jsonb_proxy *
+pllua_jsonb_proxy_new(lua_State *L, JsonbContainer *jc, uint32 len, int pidx)
+{
+	pllua_jsonb_proxy *parent = pllua_checkobject(L, pidx, PLLUA_JSONB_PROXY_OBJECT);
+	pllua_jsonb_proxy *p;
+
+	pidx = lua_absindex(L, pidx);
+
+	p = pllua_newobject(L, PLLUA_JSONB_PROXY_OBJECT, sizeof(pllua_jsonb_proxy), true);
+	p->container = jc;
+	p->len = len;
+	p->keep_numeric = parent->keep_numeric;
+	lua_pushvalue(L, pidx);
+	pllua_set_user_field(L, -2, "parent");
+	pllua_get_user_field(L, pidx, "null");
+	pllua_set_user_field(L, -2, "null");
+	return p;
+}
 
 /*
- * Test whether a table returned from jsonb_map was originally an object or
- * array.
+ * Push the Lua equivalent of a value found inside the proxy at pidx.
+ *
+ * Upvalue 3 is the typeinfo pgtype.numeric.
  */
-static int
-pllua_jsonb_table_is_object(lua_State *L)
+static void
+pllua_jsonb_proxy_pushvalue(lua_State *L, JsonbValue *v, int pidx)
 {
-	luaL_checktype(L, 1, LUA_TTABLE);
-	if (luaL_getmetafield(L, 1, "__jsonb_object") != LUA_TBOOLEAN)
-		return 0;
-	return 1;
-}
+	pllua_jsonb_proxy *p = pllua_checkobject(L, pidx, PLLUA_JSONB_PROXY_OBJECT);
 
-static int
-pllua_jsonb_table_is_array(lua_State *L)
-{
-	luaL_checktype(L, 1, LUA_TTABLE);
-	if (luaL_getmetafield(L, 1, "__jsonb_object") != LUA_TBOOLEAN)
-		return 0;
-	lua_pushboolean(L, !lua_toboolean(L, -1));
-	return 1;
-}
+	pidx = lua_absindex(L, pidx);
 
-static int
-pllua_jsonb_table_set_table_mt(lua_State *L, const char *mtname)
-{
-	luaL_checktype(L, 1, LUA_TTABLE);
-	if (lua_getmetatable(L, 1))
+	switch (v->type)
 	{
-		lua_getfield(L, lua_upvalueindex(1), "object_mt");
-		if (!lua_rawequal(L, -1, -2))
-		{
-			lua_getfield(L, lua_upvalueindex(1), "array_mt");
-			if (!lua_rawequal(L, -1, -3))
-				luaL_argerror(L, 1, "cannot replace existing metatable");
-		}
+		case jbvNull:
+			pllua_get_user_field(L, pidx, "null");
+			break;
+		case jbvBool:
+			lua_pushboolean(L, v->val.boolean);
+			break;
+		case jbvString:
+			lua_pushlstring(L, v->val.string.val, v->val.string.len);
+			break;
+		case jbvNumeric:
+			{
+				pllua_typeinfo *numt = *pllua_torefobject(L, lua_upvalueindex(3), PLLUA_TYPEINFO_OBJECT);
+				pllua_datum_single(L, NumericGetDatum(v->val.numeric), false, lua_upvalueindex(3), numt);
+				if (!p->keep_numeric)
+				{
+					lua_getfield(L, -1, "tonumber");
+					lua_insert(L, -2);
+					lua_call(L, 1, 1);
+				}
+			}
+			break;
+		case jbvBinary:
+			pllua_jsonb_proxy_new(L, v->val.binary.data, v->val.binary.len, pidx);
+			break;
+		default:
+			luaL_error(L, "unexpected jsonb value type");
 	}
-	if (mtname)
-		lua_getfield(L, lua_upvalueindex(1), mtname);
-	else
-		lua_pushnil(L);
-	lua_setmetatable(L, 1);
-	lua_settop(L, 1);
-	return 1;
 }
 
-static int
-pllua_jsonb_table_set_object(lua_State *L)
+/*
+ * Create an iterator over the container of the proxy at pidx, leaving it on
+ * the stack.
+ */
+static pllua_jsonb_iter *
+pllua_jsonb_iter_new(lua_State *L, int pidx)
 {
-	return pllua_jsonb_table_set_table_mt(L, "object_mt");
+	pllua_jsonb_proxy *p = pllua_checkobject(L, pidx, PLLUA_JSONB_PROXY_OBJECT);
+	pllua_jsonb_iter *iter;
+
+	pidx = lua_absindex(L, pidx);
+
+	iter = pllua_newobject(L, PLLUA_JSONB_ITER_OBJECT, sizeof(pllua_jsonb_iter), true);
+	iter->it = NULL;
+	iter->depth = 0;
+	iter->raw_scalar = false;
+	lua_pushvalue(L, pidx);
+	pllua_set_user_field(L, -2, "proxy");
+	lua_getuservalue(L, -1);
+	iter->mcxt = pllua_newmemcontext(L, "pllua jsonb iterator", ALLOCSET_SMALL_SIZES);
+	lua_rawsetp(L, -2, PLLUA_MCONTEXT_MEMBER);
+	lua_pop(L, 1);
+
+	PLLUA_TRY();
+	{
+		MemoryContext oldcontext = MemoryContextSwitchTo(iter->mcxt);
+		iter->it = JsonbIteratorInit(p->container);
+		MemoryContextSwitchTo(oldcontext);
+	}
+	PLLUA_CATCH_RETHROW();
+
+	return iter;
 }
 
-static int
-pllua_jsonb_table_set_array(lua_State *L)
+static JsonbIteratorToken
+pllua_jsonb_iter_next(lua_State *L, pllua_jsonb_iter *iter, JsonbValue *v, bool skip_nested)
 {
-	return pllua_jsonb_table_set_table_mt(L, "array_mt");
+	volatile JsonbIteratorToken r = WJB_DONE;
+
+	if (!iter->it)
+		return WJB_DONE;
+
+	PLLUA_TRY();
+	{
+		MemoryContext oldcontext = MemoryContextSwitchTo(iter->mcxt);
+		r = JsonbIteratorNext(&iter->it, v, skip_nested);
+		MemoryContextSwitchTo(oldcontext);
+	}
+	PLLUA_CATCH_RETHROW();
+
+	return r;
 }
 
-static int
-pllua_jsonb_table_set_unknown(lua_State *L)
+/*
+ * Push a proxy for the jsonb datum at index 1, with the config table (or nil)
+ * at index 2. The proxy may have a scalar root. Returns the root Jsonb.
+ *
+ * Upvalue 2 is the typeinfo pgtype.jsonb.
+ */
+static Jsonb *
+pllua_jsonb_proxy_push(lua_State *L)
 {
-	return pllua_jsonb_table_set_table_mt(L, NULL);
-}
+	pllua_datum *d = pllua_checkdatum(L, 1, lua_upvalueindex(2));
+	pllua_typeinfo *t = *pllua_torefobject(L, lua_upvalueindex(2), PLLUA_TYPEINFO_OBJECT);
+	pllua_jsonb_proxy *p;
+	Jsonb	   *volatile jb = (Jsonb *) DatumGetPointer(d->value);
+	bool		keep_numeric = false;
 
-static luaL_Reg jsonb_funcs[] = {
-	{ "is_object", pllua_jsonb_table_is_object },
-	{ "is_array", pllua_jsonb_table_is_array },
-	{ "set_as_object", pllua_jsonb_table_set_object },
-	{ "set_as_array", pllua_jsonb_table_set_array },
-	{ "set_as_unknown", pllua_jsonb_table_set_unknown },
-	{ NULL, NULL }
-};
+	if (t->typeoid != JSONBOID)
+		luaL_error(L, "datum is not of type jsonb");
 
-int pllua_open_jsonb(lua_State *L)
-{
-	lua_settop(L, 0);
+	if (lua_istable(L, 2))
+	{
+		lua_getfield(L, 2, "pg_numeric");
+		keep_numeric = lua_toboolean(L, -1);
+		lua_pop(L, 1);
+		lua_getfield(L, 2, "null");
+	}
+	else
+		lua_pushnil(L);
 
-	lua_newtable(L);	/* module private data table at index 1 */
+	p = pllua_newobject(L, PLLUA_JSONB_PROXY_OBJECT, sizeof(pllua_jsonb_proxy), true);
+	p->keep_numeric = keep_numeric;
+	lua_insert(L, -2);
+	pllua_set_user_field(L, -2, "null");
+	lua_pushvalue(L, 1);
+	pllua_set_user_field(L, -2, "parent");
 
-	lua_pushcfunction(L, pllua_typeinfo_lookup);
-	lua_pushinteger(L, JSONBOID);
-	lua_call(L, 1, 1);
-	lua_setfield(L, 1, "jsonb_type");
+	if (VARATT_IS_EXTENDED(jb))
+	{
+		MemoryContext mcxt;
 
-	lua_pushcfunction(L, pllua_typeinfo_lookup);
-	lua_pushinteger(L, NUMERICOID);
-	lua_call(L, 1, 1);
-	lua_setfield(L, 1, "numeric_type");
+		lua_getuservalue(L, -1);
+		mcxt = pllua_newmemcontext(L, "pllua jsonb proxy", ALLOCSET_SMALL_SIZES);
+		lua_rawsetp(L, -2, PLLUA_MCONTEXT_MEMBER);
+		lua_pop(L, 1);
 
-	luaL_getsubtable(L, LUA_REGISTRYINDEX, "_LOADED");
-	if (lua_getfield(L, -1, "table") != LUA_TTABLE)
-		luaL_error(L, "table package is not loaded");
-	if (lua_getfield(L, -1, "sort") != LUA_TFUNCTION)
+		PLLUA_TRY();
+		{
+			MemoryContext oldcontext = MemoryContextSwitchTo(mcxt);
+			jb = DatumGetJsonbP(d->value);
+			MemoryContextSwitchTo(oldcontext);
+		}
+		PLLUA_CATCH_RETHROW();
+	}
+
+	p->container = &jb->root;
+	p->len = VARSIZE(jb) - VARHDRSZ;
+
+	return jb;
+}
+
+/*
+ * jsonb.proxy(d [, config])
+ *
+ * config keys:
+ *  - null = (any value)
+ *  - pg_numeric = (boolean)
+ *
+ * A jsonb value with a scalar at top level just returns the scalar.
+ */
+static int
+pllua_jsonb_proxy_create(lua_State *L)
+{
+	Jsonb	   *jb;
+	JsonbValue	v;
+
+	lua_settop(L, 2);
+	jb = pllua_jsonb_proxy_push(L);
+
+	if (!JB_ROOT_IS_SCALAR(jb))
+		return 1;
+
+	PLLUA_TRY();
+	{
+		JsonbValue *res = getIthJsonbValueFromContainer(&jb->root, 0);
+		v = *res;
+		pfree(res);
+	}
+	PLLUA_CATCH_RETHROW();
+
+	pllua_jsonb_proxy_pushvalue(L, &v, -1);
+	return 1;
+}
+
+/*
+ * __index(proxy, key)
+ *
+ * Array elements are indexed from 1, as for converted tables.
+ */
+static int
+pllua_jsonb_proxy_index(lua_State *L)
+{
+	pllua_jsonb_proxy *p = pllua_checkobject(L, 1, PLLUA_JSONB_PROXY_OBJECT);
+	JsonbContainer *jc = p->container;
+	JsonbValue	v;
+	JsonbValue	key;
+	volatile bool found = false;
+	lua_Integer	idx = 0;
+
+	if (JsonContainerIsArray(jc))
+	{
+		int			isint = 0;
+
+		idx = lua_tointegerx(L, 2, &isint);
+		if (!isint || idx < 1 || idx > JsonContainerSize(jc))
+			return 0;
+	}
+	else
+	{
+		size_t		len = 0;
+		const char *str;
+
+		if (lua_type(L, 2) != LUA_TSTRING && lua_type(L, 2) != LUA_TNUMBER)
+			return 0;
+		str = lua_tolstring(L, 2, &len);
+		key.type = jbvString;
+		key.val.string.val = (char *) str;
+		key.val.string.len = len;
+	}
+
+	PLLUA_TRY();
+	{
+		JsonbValue *res;
+
+		if (JsonContainerIsArray(jc))
+			res = getIthJsonbValueFromContainer(jc, (uint32) (idx - 1));
+		else
+			res = findJsonbValueFromContainer(jc, JB_FOBJECT, &key);
+		if (res)
+		{
+			v = *res;
+			pfree(res);
+			found = true;
+		}
+	}
+	PLLUA_CATCH_RETHROW();
+
+	if (!found)
+		return 0;
+
+	pllua_jsonb_proxy_pushvalue(L, &v, 1);
+	return 1;
+}
+
+/*
+ * __len(proxy)
+ *
+ * For objects, this is the number of keys.
+ */
+static int
+pllua_jsonb_proxy_len(lua_State *L)
+{
+	pllua_jsonb_proxy *p = pllua_checkobject(L, 1, PLLUA_JSONB_PROXY_OBJECT);
+	lua_pushinteger(L, JsonContainerSize(p->container));
+	return 1;
+}
+
+/*
+ * iterator for arrays: next(proxy, idx)
+ */
+static int
+pllua_jsonb_proxy_inext(lua_State *L)
+{
+	pllua_jsonb_proxy *p = pllua_checkobject(L, 1, PLLUA_JSONB_PROXY_OBJECT);
+	lua_Integer	idx = luaL_checkinteger(L, 2) + 1;
+	JsonbValue	v;
+
+	if (idx < 1 || idx > JsonContainerSize(p->container))
+		return 0;
+
+	PLLUA_TRY();
+	{
+		JsonbValue *res = getIthJsonbValueFromContainer(p->container, (uint32) (idx - 1));
+		if (!res)
+			elog(ERROR, "jsonb array element not found");
+		v = *res;
+		pfree(res);
+	}
+	PLLUA_CATCH_RETHROW();
+
+	lua_pushinteger(L, idx);
+	pllua_jsonb_proxy_pushvalue(L, &v, 1);
+	return 2;
+}
+
+/*
+ * iterator for objects: next(iter, prevkey)
+ */
+static int
+pllua_jsonb_proxy_onext(lua_State *L)
+{
+	pllua_jsonb_iter *iter = pllua_checkobject(L, 1, PLLUA_JSONB_ITER_OBJECT);
+	JsonbValue	v;
+	JsonbIteratorToken r;
+
+	lua_settop(L, 1);
+	pllua_get_user_field(L, 1, "proxy");
+
+	do
+	{
+		r = pllua_jsonb_iter_next(L, iter, &v, true);
+	} while (r != WJB_KEY && r != WJB_DONE);
+
+	if (r == WJB_DONE)
+	{
+		iter->it = NULL;
+		return 0;
+	}
+
+	lua_pushlstring(L, v.val.string.val, v.val.string.len);
+
+	if (pllua_jsonb_iter_next(L, iter, &v, true) != WJB_VALUE)
+		luaL_error(L, "unexpected return from jsonb iterator");
+
+	pllua_jsonb_proxy_pushvalue(L, &v, 2);
+	return 2;
+}
+
+/*
+ * __pairs(proxy)
+ *
+ * Arrays are iterated by index; objects need a JsonbIterator since there's
+ * no way to fetch the Nth key of an object.
+ */
+static int
+pllua_jsonb_proxy_pairs(lua_State *L)
+{
+	pllua_jsonb_proxy *p = pllua_checkobject(L, 1, PLLUA_JSONB_PROXY_OBJECT);
+
+	lua_settop(L, 1);
+	if (JsonContainerIsArray(p->container))
+	{
+		lua_getfield(L, lua_upvalueindex(1), "proxy_inext");
+		lua_pushvalue(L, 1);
+		lua_pushinteger(L, 0);
+	}
+	else
+	{
+		lua_getfield(L, lua_upvalueindex(1), "proxy_onext");
+		pllua_jsonb_iter_new(L, 1);
+		lua_pushnil(L);
+	}
+	return 3;
+}
+
+/*
+ * Streaming event iteration.
+ *
+ * d:events([config]) returns an iterator producing, in document order:
+ *
+ *   "begin_object", key          "end_object", key
+ *   "begin_array", key           "end_array", key
+ *   "value", key, value
+ *
+ * where key is the object key or the array index (from 1) under which the
+ * item appears in its parent, or nil at top level. Values are scalars
+ * converted as for proxies; nested containers are never materialized. The
+ * only state kept besides the JsonbIterator is the "path" table in the
+ * iterator's uservalue, holding the current key at each nesting level
+ * (an integer for arrays, a string for objects).
+ *
+ * config is as for jsonb.proxy.
+ */
+
+/*
+ * Push the key at the current depth; for arrays, advance the index first.
+ */
+static void
+pllua_jsonb_events_pushkey(lua_State *L, int pathidx, int depth, bool advance)
+{
+	if (depth == 0)
+	{
+		lua_pushnil(L);
+		return;
+	}
+	if (lua_rawgeti(L, pathidx, depth) == LUA_TNUMBER && advance)
+	{
+		lua_Integer idx = lua_tointeger(L, -1) + 1;
+		lua_pop(L, 1);
+		lua_pushinteger(L, idx);
+		lua_pushinteger(L, idx);
+		lua_rawseti(L, pathidx, depth);
+	}
+}
+
+/*
+ * __call(iter [, state, control])
+ *
+ * Upvalue 3 is the typeinfo pgtype.numeric.
+ */
+static int
+pllua_jsonb_events_next(lua_State *L)
+{
+	pllua_jsonb_iter *iter = pllua_checkobject(L, 1, PLLUA_JSONB_ITER_OBJECT);
+	JsonbValue	v;
+	JsonbIteratorToken r;
+	int			pidx = 2;
+	int			pathidx = 3;
+
+	lua_settop(L, 1);
+	pllua_get_user_field(L, 1, "proxy");
+	if (pllua_get_user_field(L, 1, "path") != LUA_TTABLE)
+		luaL_error(L, "not an event iterator");
+
+	for (;;)
+	{
+		r = pllua_jsonb_iter_next(L, iter, &v, false);
+
+		switch (r)
+		{
+			case WJB_DONE:
+				iter->it = NULL;
+				return 0;
+
+			case WJB_KEY:
+				lua_pushlstring(L, v.val.string.val, v.val.string.len);
+				lua_rawseti(L, pathidx, iter->depth);
+				continue;
+
+			case WJB_BEGIN_ARRAY:
+				/* iterator puts a dummy array around scalars */
+				if (v.val.array.rawScalar)
+				{
+					iter->raw_scalar = true;
+					continue;
+				}
+				/* FALLTHROUGH */
+			case WJB_BEGIN_OBJECT:
+				lua_pushstring(L, (r == WJB_BEGIN_ARRAY) ? "begin_array" : "begin_object");
+				pllua_jsonb_events_pushkey(L, pathidx, iter->depth, true);
+				++iter->depth;
+				if (r == WJB_BEGIN_ARRAY)
+					lua_pushinteger(L, 0);
+				else
+					lua_pushboolean(L, 0);
+				lua_rawseti(L, pathidx, iter->depth);
+				return 2;
+
+			case WJB_END_ARRAY:
+				if (iter->raw_scalar)
+					continue;
+				/* FALLTHROUGH */
+			case WJB_END_OBJECT:
+				lua_pushnil(L);
+				lua_rawseti(L, pathidx, iter->depth);
+				--iter->depth;
+				lua_pushstring(L, (r == WJB_END_ARRAY) ? "end_array" : "end_object");
+				pllua_jsonb_events_pushkey(L, pathidx, iter->depth, false);
+				return 2;
+
+			case WJB_VALUE:
+			case WJB_ELEM:
+				lua_pushstring(L, "value");
+				pllua_jsonb_events_pushkey(L, pathidx, iter->depth, (r == WJB_ELEM));
+				pllua_jsonb_proxy_pushvalue(L, &v, pidx);
+				return 3;
+
+			default:
+				luaL_error(L, "unexpected return from jsonb iterator");
+		}
+	}
+}
+
+/*
+ * d:events([config])
+ */
+static int
+pllua_jsonb_events(lua_State *L)
+{
+	lua_settop(L, 2);
+	pllua_jsonb_proxy_push(L);
+	pllua_jsonb_iter_new(L, -1);
+	lua_newtable(L);
+	pllua_set_user_field(L, -2, "path");
+	return 1;
+}
+
+static int
+pllua_jsonb_proxy_tostring(lua_State *L)
+{
+	pllua_jsonb_proxy *p = pllua_checkobject(L, 1, PLLUA_JSONB_PROXY_OBJECT);
+	char	   *volatile str = NULL;
+
+	PLLUA_TRY();
+	{
+		str = JsonbToCString(NULL, p->container, p->len);
+	}
+	PLLUA_CATCH_RETHROW();
+
+	lua_pushstring(L, str);
+	return 1;
+}
+
+static luaL_Reg jsonb_proxy_mt[] = {
+	{ "__len", pllua_jsonb_proxy_len },
+	{ "__tostring", pllua_jsonb_proxy_tostring },
+	{ NULL, NULL }
+};
+
+/* these need the same upvalues as jsonb_meta */
+static luaL_Reg jsonb_proxy_upval_mt[] = {
+	{ "__index", pllua_jsonb_proxy_index },
+	{ "__pairs", pllua_jsonb_proxy_pairs },
+	{ NULL, NULL }
+};
+
+#if PG_VERSION_NUM >= 120000
+/*
+ * Compiled jsonpath expressions.
+ *
+ * jsonb.path(expr) parses the expression once and keeps the jsonpath value
+ * in the object's memory context, so that evaluating it repeatedly needs no
+ * parsing and no SPI. Evaluation goes through the same functions as the SQL
+ * jsonb_path_* functions. The executor has no interface for producing
+ * results one at a time, so :query collects them with jsonb_path_query_array
+ * and then hands them out one by one as jsonb datums, created only as they
+ * are fetched.
+ */
+typedef struct pllua_jsonb_path
+{
+	Datum		path;
+	Datum		emptyvars;
+} pllua_jsonb_path;
+
+/*
+ * jsonb.path(expr)
+ */
+static int
+pllua_jsonb_path_compile(lua_State *L)
+{
+	const char *str = luaL_checkstring(L, 1);
+	pllua_jsonb_path *jp;
+	MemoryContext mcxt;
+
+	jp = pllua_newobject(L, PLLUA_JSONB_PATH_OBJECT, sizeof(pllua_jsonb_path), true);
+	jp->path = (Datum) 0;
+	jp->emptyvars = (Datum) 0;
+	lua_getuservalue(L, -1);
+	mcxt = pllua_newmemcontext(L, "pllua jsonpath", ALLOCSET_SMALL_SIZES);
+	lua_rawsetp(L, -2, PLLUA_MCONTEXT_MEMBER);
+	lua_pop(L, 1);
+
+	PLLUA_TRY();
+	{
+		MemoryContext oldcontext = MemoryContextSwitchTo(mcxt);
+		jp->path = DirectFunctionCall1(jsonpath_in, CStringGetDatum(str));
+		jp->emptyvars = DirectFunctionCall1(jsonb_in, CStringGetDatum("{}"));
+		MemoryContextSwitchTo(oldcontext);
+	}
+	PLLUA_CATCH_RETHROW();
+
+	return 1;
+}
+
+/*
+ * Get the doc and vars arguments of query/exists as jsonb datums, converting
+ * vars from a Lua table if need be.
+ *
+ * Upvalue 2 is the typeinfo pgtype.jsonb.
+ */
+static void
+pllua_jsonb_path_args(lua_State *L, pllua_jsonb_path *jp, Datum *doc, Datum *vars)
+{
+	pllua_datum *d = pllua_checkdatum(L, 2, lua_upvalueindex(2));
+	pllua_datum *v;
+
+	*doc = d->value;
+
+	if (lua_isnil(L, 3))
+	{
+		*vars = jp->emptyvars;
+		return;
+	}
+	if (!(v = pllua_todatum(L, 3, lua_upvalueindex(2))))
+	{
+		lua_pushvalue(L, lua_upvalueindex(2));
+		lua_pushvalue(L, 3);
+		lua_call(L, 1, 1);
+		lua_replace(L, 3);
+		v = pllua_checkdatum(L, 3, lua_upvalueindex(2));
+	}
+	*vars = v->value;
+}
+
+/*
+ * iterator closure; upvalue 1 is the jsonb typeinfo, 2 the result array
+ * datum, 3 the index of the last element returned.
+ */
+static int
+pllua_jsonb_path_next(lua_State *L)
+{
+	pllua_typeinfo *t = *pllua_torefobject(L, lua_upvalueindex(1), PLLUA_TYPEINFO_OBJECT);
+	pllua_datum *d = pllua_checkdatum(L, lua_upvalueindex(2), lua_upvalueindex(1));
+	lua_Integer	idx = lua_tointeger(L, lua_upvalueindex(3));
+	Jsonb	   *jb = (Jsonb *) DatumGetPointer(d->value);
+	pllua_datum *nd;
+
+	if (idx >= JB_ROOT_COUNT(jb))
+		return 0;
+
+	lua_pushinteger(L, idx + 1);
+	lua_replace(L, lua_upvalueindex(3));
+
+	nd = pllua_newdatum(L, lua_upvalueindex(1), (Datum)0);
+
+	PLLUA_TRY();
+	{
+		JsonbValue *res = getIthJsonbValueFromContainer(&jb->root, (uint32) idx);
+		Jsonb	   *rjb = JsonbValueToJsonb(res);
+		MemoryContext oldcontext = MemoryContextSwitchTo(pllua_get_memory_cxt(L));
+
+		nd->value = PointerGetDatum(rjb);
+		pllua_savedatum(L, nd, t);
+		MemoryContextSwitchTo(oldcontext);
+		pfree(rjb);
+		pfree(res);
+	}
+	PLLUA_CATCH_RETHROW();
+
+	return 1;
+}
+
+/*
+ * path:query(doc [, vars [, silent]])  returns an iterator of jsonb values
+ */
+static int
+pllua_jsonb_path_query(lua_State *L)
+{
+	pllua_jsonb_path *jp = pllua_checkobject(L, 1, PLLUA_JSONB_PATH_OBJECT);
+	pllua_typeinfo *t = *pllua_torefobject(L, lua_upvalueindex(2), PLLUA_TYPEINFO_OBJECT);
+	bool		silent;
+	Datum		doc;
+	Datum		vars;
+	pllua_datum *nd;
+
+	lua_settop(L, 4);
+	silent = lua_toboolean(L, 4);
+	pllua_jsonb_path_args(L, jp, &doc, &vars);
+
+	lua_pushvalue(L, lua_upvalueindex(2));
+	nd = pllua_newdatum(L, lua_upvalueindex(2), (Datum)0);
+
+	PLLUA_TRY();
+	{
+		Datum		res = DirectFunctionCall4(jsonb_path_query_array,
+											  doc, jp->path, vars,
+											  BoolGetDatum(silent));
+		MemoryContext oldcontext = MemoryContextSwitchTo(pllua_get_memory_cxt(L));
+
+		nd->value = res;
+		pllua_savedatum(L, nd, t);
+		MemoryContextSwitchTo(oldcontext);
+		pfree(DatumGetPointer(res));
+	}
+	PLLUA_CATCH_RETHROW();
+
+	lua_pushinteger(L, 0);
+	lua_pushcclosure(L, pllua_jsonb_path_next, 3);
+	return 1;
+}
+
+/*
+ * path:exists(doc [, vars [, silent]])
+ *
+ * Returns nil rather than a boolean if silent is set and the path could not
+ * be evaluated, as for the SQL function.
+ */
+static int
+pllua_jsonb_path_exists(lua_State *L)
+{
+	pllua_jsonb_path *jp = pllua_checkobject(L, 1, PLLUA_JSONB_PATH_OBJECT);
+	bool		silent;
+	Datum		doc;
+	Datum		vars;
+	volatile bool isnull = false;
+	volatile bool result = false;
+
+	lua_settop(L, 4);
+	silent = lua_toboolean(L, 4);
+	pllua_jsonb_path_args(L, jp, &doc, &vars);
+
+	PLLUA_TRY();
+	{
+		LOCAL_FCINFO(fcinfo, 4);
+		Datum		res;
+
+		InitFunctionCallInfoData(*fcinfo, NULL, 4, InvalidOid, NULL, NULL);
+		fcinfo->args[0].value = doc;
+		fcinfo->args[0].isnull = false;
+		fcinfo->args[1].value = jp->path;
+		fcinfo->args[1].isnull = false;
+		fcinfo->args[2].value = vars;
+		fcinfo->args[2].isnull = false;
+		fcinfo->args[3].value = BoolGetDatum(silent);
+		fcinfo->args[3].isnull = false;
+		res = jsonb_path_exists(fcinfo);
+		isnull = fcinfo->isnull;
+		if (!isnull)
+			result = DatumGetBool(res);
+	}
+	PLLUA_CATCH_RETHROW();
+
+	if (isnull)
+		lua_pushnil(L);
+	else
+		lua_pushboolean(L, result);
+	return 1;
+}
+
+static int
+pllua_jsonb_path_tostring(lua_State *L)
+{
+	pllua_jsonb_path *jp = pllua_checkobject(L, 1, PLLUA_JSONB_PATH_OBJECT);
+	char	   *volatile str = NULL;
+
+	PLLUA_TRY();
+	{
+		str = DatumGetCString(DirectFunctionCall1(jsonpath_out, jp->path));
+	}
+	PLLUA_CATCH_RETHROW();
+
+	lua_pushstring(L, str);
+	return 1;
+}
+
+static luaL_Reg jsonb_path_mt[] = {
+	{ "__tostring", pllua_jsonb_path_tostring },
+	{ NULL, NULL }
+};
+
+/* with the same upvalues as jsonb_meta */
+static luaL_Reg jsonb_path_methods[] = {
+	{ "query", pllua_jsonb_path_query },
+	{ "exists", pllua_jsonb_path_exists },
+	{ NULL, NULL }
+};
+#endif
+
+static luaL_Reg jsonb_iter_mt[] = {
+	{ NULL, NULL }
+};
+
+/* also with the same upvalues as jsonb_meta */
+static luaL_Reg jsonb_iter_upval_mt[] = {
+	{ "__call", pllua_jsonb_events_next },
+	{ NULL, NULL }
+};
+
+/* methods on jsonb datums, with the same upvalues as jsonb_meta */
+static luaL_Reg jsonb_methods[] = {
+	{ "events", pllua_jsonb_events },
+	{ "proxy", pllua_jsonb_proxy_create },
+	{ NULL, NULL }
+};
+
+static luaL_Reg jsonb_meta[] = {
+	{ "__call", pllua_jsonb_map },
+	{ "tosql", pllua_jsonb_tosql },
+	{ NULL, NULL }
+};
+
+/*
+ * Test whether a table returned from jsonb_map was originally an object or
+ * array. Also accepts proxies.
+ */
+static int
+pllua_jsonb_table_is_object(lua_State *L)
+{
+	pllua_jsonb_proxy *p = pllua_toobject(L, 1, PLLUA_JSONB_PROXY_OBJECT);
+	if (p)
+	{
+		lua_pushboolean(L, JsonContainerIsObject(p->container));
+		return 1;
+	}
+	luaL_checktype(L, 1, LUA_TTABLE);
+	if (luaL_getmetafield(L, 1, "__jsonb_object") != LUA_TBOOLEAN)
+		return 0;
+	return 1;
+}
+
+static int
+pllua_jsonb_table_is_array(lua_State *L)
+{
+	pllua_jsonb_proxy *p = pllua_toobject(L, 1, PLLUA_JSONB_PROXY_OBJECT);
+	if (p)
+	{
+		lua_pushboolean(L, JsonContainerIsArray(p->container));
+		return 1;
+	}
+	luaL_checktype(L, 1, LUA_TTABLE);
+	if (luaL_getmetafield(L, 1, "__jsonb_object") != LUA_TBOOLEAN)
+		return 0;
+	lua_pushboolean(L, !lua_toboolean(L, -1));
+	return 1;
+}
+
+static int
+pllua_jsonb_table_set_table_mt(lua_State *L, const char *mtname)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+	if (lua_getmetatable(L, 1))
+	{
+		lua_getfield(L, lua_upvalueindex(1), "object_mt");
+		if (!lua_rawequal(L, -1, -2))
+		{
+			lua_getfield(L, lua_upvalueindex(1), "array_mt");
+			if (!lua_rawequal(L, -1, -3))
+				luaL_argerror(L, 1, "cannot replace existing metatable");
+		}
+	}
+	if (mtname)
+		lua_getfield(L, lua_upvalueindex(1), mtname);
+	else
+		lua_pushnil(L);
+	lua_setmetatable(L, 1);
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int
+pllua_jsonb_table_set_object(lua_State *L)
+{
+	return pllua_jsonb_table_set_table_mt(L, "object_mt");
+}
+
+static int
+pllua_jsonb_table_set_array(lua_State *L)
+{
+	return pllua_jsonb_table_set_table_mt(L, "array_mt");
+}
+
+static int
+pllua_jsonb_table_set_unknown(lua_State *L)
+{
+	return pllua_jsonb_table_set_table_mt(L, NULL);
+}
+
+static luaL_Reg jsonb_funcs[] = {
+	{ "is_object", pllua_jsonb_table_is_object },
+	{ "is_array", pllua_jsonb_table_is_array },
+	{ "set_as_object", pllua_jsonb_table_set_object },
+	{ "set_as_array", pllua_jsonb_table_set_array },
+	{ "set_as_unknown", pllua_jsonb_table_set_unknown },
+	{ "proxy", pllua_jsonb_proxy_create },
+#if PG_VERSION_NUM >= 120000
+	{ "path", pllua_jsonb_path_compile },
+#endif
+	{ NULL, NULL }
+};
+
+int pllua_open_jsonb(lua_State *L)
+{
+	lua_settop(L, 0);
+
+	lua_newtable(L);	/* module private data table at index 1 */
+
+	lua_pushcfunction(L, pllua_typeinfo_lookup);
+	lua_pushinteger(L, JSONBOID);
+	lua_call(L, 1, 1);
+	lua_setfield(L, 1, "jsonb_type");
+
+	lua_pushcfunction(L, pllua_typeinfo_lookup);
+	lua_pushinteger(L, NUMERICOID);
+	lua_call(L, 1, 1);
+	lua_setfield(L, 1, "numeric_type");
+
+	luaL_getsubtable(L, LUA_REGISTRYINDEX, "_LOADED");
+	if (lua_getfield(L, -1, "table") != LUA_TTABLE)
+		luaL_error(L, "table package is not loaded");
+	if (lua_getfield(L, -1, "sort") != LUA_TFUNCTION)
 		luaL_error(L, "table.sort function not found");
 	lua_remove(L, -2);
 	lua_remove(L, -2);
@@ -930,6 +1983,8 @@ int pllua_open_jsonb(lua_State *L)
 	lua_setfield(L, -2, "__metatable");
 	lua_pushboolean(L, 0);
 	lua_setfield(L, -2, "__jsonb_object");
+	lua_pushvalue(L, -1);
+	lua_rawsetp(L, LUA_REGISTRYINDEX, PLLUA_JSON_ARRAY_MT);
 	lua_setfield(L, 1, "array_mt");
 
 	lua_newtable(L);
@@ -937,13 +1992,53 @@ int pllua_open_jsonb(lua_State *L)
 	lua_setfield(L, -2, "__metatable");
 	lua_pushboolean(L, 1);
 	lua_setfield(L, -2, "__jsonb_object");
+	lua_pushvalue(L, -1);
+	lua_rawsetp(L, LUA_REGISTRYINDEX, PLLUA_JSON_OBJECT_MT);
 	lua_setfield(L, 1, "object_mt");
 
+	pllua_newmetatable(L, PLLUA_JSONB_ITER_OBJECT, jsonb_iter_mt);
+	lua_pushvalue(L, 1);
+	lua_getfield(L, 1, "jsonb_type");
+	lua_getfield(L, 1, "numeric_type");
+	luaL_setfuncs(L, jsonb_iter_upval_mt, 3);
+	lua_pop(L, 1);
+
+#if PG_VERSION_NUM >= 120000
+	pllua_newmetatable(L, PLLUA_JSONB_PATH_OBJECT, jsonb_path_mt);
+	lua_newtable(L);
+	lua_pushvalue(L, 1);
+	lua_getfield(L, 1, "jsonb_type");
+	lua_getfield(L, 1, "numeric_type");
+	luaL_setfuncs(L, jsonb_path_methods, 3);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+#endif
+
+	pllua_newmetatable(L, PLLUA_JSONB_PROXY_OBJECT, jsonb_proxy_mt);
+	lua_pushvalue(L, 1);
+	lua_getfield(L, 1, "jsonb_type");
+	lua_getfield(L, 1, "numeric_type");
+	luaL_setfuncs(L, jsonb_proxy_upval_mt, 3);
+	lua_pop(L, 1);
+
+	lua_pushvalue(L, 1);
+	lua_getfield(L, 1, "jsonb_type");
+	lua_getfield(L, 1, "numeric_type");
+	lua_pushcclosure(L, pllua_jsonb_proxy_inext, 3);
+	lua_setfield(L, 1, "proxy_inext");
+
+	lua_pushvalue(L, 1);
+	lua_getfield(L, 1, "jsonb_type");
+	lua_getfield(L, 1, "numeric_type");
+	lua_pushcclosure(L, pllua_jsonb_proxy_onext, 3);
+	lua_setfield(L, 1, "proxy_onext");
+
 	lua_newtable(L);  /* module table at index 2 */
 
 	lua_pushvalue(L, 1);
 	lua_getfield(L, 1, "jsonb_type");
-	luaL_setfuncs(L, jsonb_funcs, 2);
+	lua_getfield(L, 1, "numeric_type");
+	luaL_setfuncs(L, jsonb_funcs, 3);
 
 	lua_getfield(L, 1, "jsonb_type");	/* jsonb typeinfo at index 3 */
 	lua_getuservalue(L, -1);  /* datum metatable at index 4 */
@@ -954,6 +2049,14 @@ int pllua_open_jsonb(lua_State *L)
 
 	luaL_setfuncs(L, jsonb_meta, 3);
 
+	/* override normal datum __index entry with our method table */
+	lua_newtable(L);
+	lua_pushvalue(L, 1);
+	lua_pushvalue(L, 3);
+	lua_getfield(L, 1, "numeric_type");
+	luaL_setfuncs(L, jsonb_methods, 3);
+	lua_setfield(L, 4, "__index");
+
 	lua_pushvalue(L, 2);
 	return 1;
 }
@@ -48,6 +48,207 @@ enum num_method_id {
 };
 
 
+/*
+ * Integer fast path.
+ *
+ * Most numeric values we see in practice are integers that fit in 64 bits,
+ * and for those we can do add/sub/mul and comparisons natively instead of via
+ * the numeric fmgr functions. To find out whether a Numeric qualifies without
+ * calling into PG, we look at its representation directly. This relies only
+ * on the on-disk format (which pg_upgrade requires to be stable), and we
+ * decline anything we don't fully understand, so the worst case is falling
+ * back to the slow path.
+ *
+ * Only values with a display scale of 0 qualify, since anything else would
+ * make the result's scale differ from what the numeric functions produce.
+ */
+#define PLLUA_NUMERIC_SIGN_MASK		0xC000
+#define PLLUA_NUMERIC_NEG			0x4000
+#define PLLUA_NUMERIC_SHORT			0x8000
+#define PLLUA_NUMERIC_SPECIAL		0xC000
+#define PLLUA_NUMERIC_DSCALE_MASK	0x3FFF
+#define PLLUA_NUMERIC_SHORT_SIGN_MASK			0x2000
+#define PLLUA_NUMERIC_SHORT_DSCALE_MASK			0x1F80
+#define PLLUA_NUMERIC_SHORT_WEIGHT_SIGN_MASK	0x0040
+#define PLLUA_NUMERIC_SHORT_WEIGHT_MASK			0x003F
+#define PLLUA_NUMERIC_NBASE			10000
+
+static bool
+pllua_numeric_getint(Datum val, int64 *result)
+{
+	struct varlena *v = (struct varlena *) DatumGetPointer(val);
+	const char *p;
+	Size		len;
+	uint16		hdr;
+	bool		neg;
+	int			dscale;
+	int			weight;
+	int			ndigits;
+	uint64		acc = 0;
+	int			i;
+
+	if (VARATT_IS_EXTERNAL(v) || VARATT_IS_COMPRESSED(v))
+		return false;
+
+	p = VARDATA_ANY(v);
+	len = VARSIZE_ANY_EXHDR(v);
+	if (len < sizeof(uint16))
+		return false;
+	memcpy(&hdr, p, sizeof(uint16));
+
+	if ((hdr & PLLUA_NUMERIC_SIGN_MASK) == PLLUA_NUMERIC_SPECIAL)
+		return false;
+	else if (hdr & PLLUA_NUMERIC_SHORT)
+	{
+		neg = (hdr & PLLUA_NUMERIC_SHORT_SIGN_MASK) != 0;
+		dscale = (hdr & PLLUA_NUMERIC_SHORT_DSCALE_MASK) >> 7;
+		weight = (hdr & PLLUA_NUMERIC_SHORT_WEIGHT_MASK);
+		if (hdr & PLLUA_NUMERIC_SHORT_WEIGHT_SIGN_MASK)
+			weight |= ~PLLUA_NUMERIC_SHORT_WEIGHT_MASK;
+		p += sizeof(uint16);
+		len -= sizeof(uint16);
+	}
+	else
+	{
+		int16		w;
+
+		if (len < 2 * sizeof(uint16))
+			return false;
+		neg = (hdr & PLLUA_NUMERIC_SIGN_MASK) == PLLUA_NUMERIC_NEG;
+		dscale = (hdr & PLLUA_NUMERIC_DSCALE_MASK);
+		memcpy(&w, p + sizeof(uint16), sizeof(int16));
+		weight = w;
+		p += 2 * sizeof(uint16);
+		len -= 2 * sizeof(uint16);
+	}
+
+	ndigits = len / sizeof(int16);
+
+	if (dscale != 0)
+		return false;
+	if (ndigits == 0)
+	{
+		*result = 0;
+		return true;
+	}
+	/* digits are stripped of trailing zeros, so this means a fraction */
+	if (ndigits > weight + 1 || weight > 4)
+		return false;
+
+	for (i = 0; i <= weight; ++i)
+	{
+		int16		dig = 0;
+
+		if (i < ndigits)
+			memcpy(&dig, p + i * sizeof(int16), sizeof(int16));
+		if (dig < 0 || dig >= PLLUA_NUMERIC_NBASE)
+			return false;
+		if (acc > (PG_UINT64_MAX - dig) / PLLUA_NUMERIC_NBASE)
+			return false;
+		acc = acc * PLLUA_NUMERIC_NBASE + dig;
+	}
+
+	if (neg)
+	{
+		if (acc > ((uint64) PG_INT64_MAX) + 1)
+			return false;
+		*result = (int64) (0 - acc);
+	}
+	else
+	{
+		if (acc > (uint64) PG_INT64_MAX)
+			return false;
+		*result = (int64) acc;
+	}
+	return true;
+}
+
+/*
+ * Get an integer operand from a Lua integer or an integral Numeric.
+ */
+static bool
+pllua_numeric_intarg(lua_State *L, int nd, pllua_datum *d, int64 *result)
+{
+	if (d)
+		return pllua_numeric_getint(d->value, result);
+	if (lua_type(L, nd) == LUA_TNUMBER)
+	{
+		int isint = 0;
+		lua_Integer	ival = lua_tointegerx(L, nd, &isint);
+		*result = (int64) ival;
+		return isint != 0;
+	}
+	return false;
+}
+
+/*
+ * Returns true and pushes the result if the operation could be done without
+ * overflow; otherwise pushes nothing and the caller takes the slow path.
+ *
+ * upvalue 1 is the numeric typeinfo object
+ */
+static bool
+pllua_numeric_intop(lua_State *L, pllua_typeinfo *t, int op, int64 i1, int64 i2)
+{
+	int64		res;
+	pllua_datum *d;
+
+	switch (op)
+	{
+		case PLLUA_NUM_EQ:
+			lua_pushboolean(L, i1 == i2);
+			return true;
+		case PLLUA_NUM_LT:
+			lua_pushboolean(L, i1 < i2);
+			return true;
+		case PLLUA_NUM_LE:
+			lua_pushboolean(L, i1 <= i2);
+			return true;
+		case PLLUA_NUM_ADD:
+			if ((i2 > 0 && i1 > PG_INT64_MAX - i2) ||
+				(i2 < 0 && i1 < PG_INT64_MIN - i2))
+				return false;
+			res = i1 + i2;
+			break;
+		case PLLUA_NUM_SUB:
+			if ((i2 < 0 && i1 > PG_INT64_MAX + i2) ||
+				(i2 > 0 && i1 < PG_INT64_MIN + i2))
+				return false;
+			res = i1 - i2;
+			break;
+		case PLLUA_NUM_MUL:
+			if (i1 == 0 || i2 == 0)
+			{
+				res = 0;
+				break;
+			}
+			if ((i1 == -1 && i2 == PG_INT64_MIN) ||
+				(i2 == -1 && i1 == PG_INT64_MIN))
+				return false;
+			res = (int64) ((uint64) i1 * (uint64) i2);
+			if (res / i2 != i1)
+				return false;
+			break;
+		default:
+			return false;
+	}
+
+	d = pllua_newdatum(L, lua_upvalueindex(1), (Datum)0);
+
+	PLLUA_TRY();
+	{
+		Datum		nval = DirectFunctionCall1(int8_numeric, Int64GetDatumFast(res));
+		MemoryContext oldcontext = MemoryContextSwitchTo(pllua_get_memory_cxt(L));
+		d->value = nval;
+		pllua_savedatum(L, d, t);
+		MemoryContextSwitchTo(oldcontext);
+		pfree(DatumGetPointer(nval));
+	}
+	PLLUA_CATCH_RETHROW();
+
+	return true;
+}
+
 static bool
 pllua_numeric_guts(lua_State *L, pllua_datum *d, pllua_typeinfo *t,
 				   Datum val1, Datum val2, int op, lua_Integer i2,
@@ -183,6 +384,17 @@ pllua_numeric_handler(lua_State *L)
 
 	lua_settop(L, 2);
 
+	if (op <= PLLUA_NUM_MUL)
+	{
+		int64		iv1;
+		int64		iv2;
+
+		if (pllua_numeric_intarg(L, 1, d1, &iv1) &&
+			pllua_numeric_intarg(L, 2, d2, &iv2) &&
+			pllua_numeric_intop(L, t, op, iv1, iv2))
+			return 1;
+	}
+
 	if (op < PLLUA_NUM_LOG)
 	{
 		val1 = pllua_numeric_getarg(L, 1, d1);
@@ -243,6 +455,7 @@ pllua_numeric_tointeger(lua_State *L)
 	pllua_datum *dmin = pllua_todatum(L, lua_upvalueindex(2), lua_upvalueindex(1));
 	pllua_datum *dmax = pllua_todatum(L, lua_upvalueindex(3), lua_upvalueindex(1));
 	int			isint1 = 0;
+	int64		ival;
 
 	lua_tointegerx(L, 1, &isint1);
 	if (isint1)
@@ -257,6 +470,13 @@ pllua_numeric_tointeger(lua_State *L)
 		return 1;
 	}
 
+	if (pllua_numeric_getint(d1->value, &ival)
+		&& ival >= LUA_MININTEGER && ival <= LUA_MAXINTEGER)
+	{
+		lua_pushinteger(L, (lua_Integer) ival);
+		return 1;
+	}
+
 	PLLUA_TRY();
 	{
 		bool res_isnil = true;
@@ -293,6 +513,7 @@ pllua_numeric_tonumber(lua_State *L)
 	pllua_datum *d1 = pllua_todatum(L, 1, lua_upvalueindex(1));
 	pllua_datum *dmin = pllua_todatum(L, lua_upvalueindex(2), lua_upvalueindex(1));
 	pllua_datum *dmax = pllua_todatum(L, lua_upvalueindex(3), lua_upvalueindex(1));
+	int64		ival;
 
 	if (!d1)
 	{
@@ -301,6 +522,13 @@ pllua_numeric_tonumber(lua_State *L)
 		return 1;
 	}
 
+	if (pllua_numeric_getint(d1->value, &ival)
+		&& ival >= LUA_MININTEGER && ival <= LUA_MAXINTEGER)
+	{
+		lua_pushinteger(L, (lua_Integer) ival);
+		return 1;
+	}
+
 	PLLUA_TRY();
 	{
 		bool done = false;
@@ -330,6 +558,277 @@ pllua_numeric_tonumber(lua_State *L)
 }
 
 
+/*
+ * Accumulators.
+ *
+ * Doing arithmetic on Numeric datums creates a new datum object (and a new
+ * palloc'd value) for every operation, which generates a lot of garbage when
+ * (for example) totalling a column over a large result set. An accumulator
+ * instead holds a running value which is updated in place.
+ *
+ * As long as only Lua integers have been fed to it, the running value is kept
+ * as a native integer (int128 where available) and no PG calls are needed;
+ * otherwise (or on overflow) it switches to holding a Numeric value in its
+ * own memory context, the old value being freed on each update.
+ */
+
+#ifdef HAVE_INT128
+typedef int128 pllua_acc_int;
+/* keep well away from the edge so that int64 operands can't overflow */
+#define PLLUA_ACC_INT_LIMIT (((int128) 1) << 125)
+#else
+typedef int64 pllua_acc_int;
+#endif
+
+typedef struct pllua_numeric_acc
+{
+	bool		isint;		/* value is in ival, not nval */
+	pllua_acc_int ival;
+	Datum		nval;		/* Numeric, allocated in mcxt */
+	MemoryContext mcxt;
+} pllua_numeric_acc;
+
+/*
+ * Try to apply op to the native integer value. Returns false (leaving the
+ * value unchanged) on overflow.
+ */
+static bool
+pllua_numeric_acc_intop(pllua_numeric_acc *acc, int op, int64 v)
+{
+	pllua_acc_int a = acc->ival;
+	pllua_acc_int r;
+
+#ifdef HAVE_INT128
+	switch (op)
+	{
+		case PLLUA_NUM_ADD:
+			r = a + v;
+			break;
+		case PLLUA_NUM_SUB:
+			r = a - v;
+			break;
+		case PLLUA_NUM_MUL:
+			if (v != 0)
+			{
+				pllua_acc_int lim = PLLUA_ACC_INT_LIMIT / ((v < 0) ? -(pllua_acc_int) v : v);
+				if (a > lim || a < -lim)
+					return false;
+			}
+			r = a * v;
+			break;
+		default:
+			return false;
+	}
+	if (r > PLLUA_ACC_INT_LIMIT || r < -PLLUA_ACC_INT_LIMIT)
+		return false;
+#else
+	switch (op)
+	{
+		case PLLUA_NUM_ADD:
+			if ((v > 0 && a > PG_INT64_MAX - v) ||
+				(v < 0 && a < PG_INT64_MIN - v))
+				return false;
+			r = a + v;
+			break;
+		case PLLUA_NUM_SUB:
+			if ((v < 0 && a > PG_INT64_MAX + v) ||
+				(v > 0 && a < PG_INT64_MIN + v))
+				return false;
+			r = a - v;
+			break;
+		case PLLUA_NUM_MUL:
+			if (a == 0 || v == 0)
+			{
+				r = 0;
+				break;
+			}
+			if ((a == -1 && v == PG_INT64_MIN) ||
+				(v == -1 && a == PG_INT64_MIN))
+				return false;
+			r = (int64) ((uint64) a * (uint64) v);
+			if (r / v != a)
+				return false;
+			break;
+		default:
+			return false;
+	}
+#endif
+	acc->ival = r;
+	return true;
+}
+
+/*
+ * PG context. Convert the native integer value to a Numeric in the current
+ * memory context.
+ */
+static Datum
+pllua_numeric_acc_int_numeric(pllua_acc_int v)
+{
+#ifdef HAVE_INT128
+	if (v < PG_INT64_MIN || v > PG_INT64_MAX)
+	{
+		/* three base-10^18 digits are enough for our range */
+		int64		base = INT64CONST(1000000000000000000);
+		int64		lo = (int64) (v % base);
+		int64		mid = (int64) ((v / base) % base);
+		int64		hi = (int64) (v / base / base);
+		Datum		nbase = DirectFunctionCall1(int8_numeric, Int64GetDatumFast(base));
+		Datum		res = DirectFunctionCall1(int8_numeric, Int64GetDatumFast(hi));
+
+		res = DirectFunctionCall2(numeric_mul, res, nbase);
+		res = DirectFunctionCall2(numeric_add, res,
+								  DirectFunctionCall1(int8_numeric, Int64GetDatumFast(mid)));
+		res = DirectFunctionCall2(numeric_mul, res, nbase);
+		res = DirectFunctionCall2(numeric_add, res,
+								  DirectFunctionCall1(int8_numeric, Int64GetDatumFast(lo)));
+		return res;
+	}
+#endif
+	return DirectFunctionCall1(int8_numeric, Int64GetDatumFast((int64) v));
+}
+
+/*
+ * numeric.accumulator([initial])
+ */
+static int
+pllua_numeric_acc_new(lua_State *L)
+{
+	pllua_numeric_acc *acc;
+
+	lua_settop(L, 1);
+	acc = pllua_newobject(L, PLLUA_NUMERIC_ACC_OBJECT, sizeof(pllua_numeric_acc), true);
+	lua_getuservalue(L, -1);
+	acc->mcxt = pllua_newmemcontext(L, "pllua numeric accumulator", ALLOCSET_SMALL_SIZES);
+	lua_rawsetp(L, -2, PLLUA_MCONTEXT_MEMBER);
+	lua_pop(L, 1);
+	acc->isint = true;
+	acc->ival = 0;
+	acc->nval = (Datum) 0;
+
+	if (!lua_isnil(L, 1))
+	{
+		lua_getfield(L, -1, "add");
+		lua_pushvalue(L, -2);
+		lua_pushvalue(L, 1);
+		lua_call(L, 2, 0);
+	}
+
+	return 1;
+}
+
+/*
+ * acc:add(x), acc:sub(x), acc:mul(x)   each returns acc
+ *
+ * upvalue 1 is the numeric typeinfo object, 2 the opcode
+ */
+static int
+pllua_numeric_acc_op(lua_State *L)
+{
+	int			op = lua_tointeger(L, lua_upvalueindex(2));
+	pllua_numeric_acc *acc = pllua_checkobject(L, 1, PLLUA_NUMERIC_ACC_OBJECT);
+	pllua_datum *d = pllua_todatum(L, 2, lua_upvalueindex(1));
+	bool		isnum = (!d && lua_type(L, 2) == LUA_TNUMBER);
+	int			isint = 0;
+	lua_Integer	ival = isnum ? lua_tointegerx(L, 2, &isint) : 0;
+	lua_Number	fval = (isnum && !isint) ? lua_tonumber(L, 2) : 0;
+	Datum		val = (Datum) 0;
+
+	lua_settop(L, 2);
+
+	if (isint && acc->isint && pllua_numeric_acc_intop(acc, op, ival))
+	{
+		lua_settop(L, 1);
+		return 1;
+	}
+
+	if (!isnum)
+		val = pllua_numeric_getarg(L, 2, d);
+
+	PLLUA_TRY();
+	{
+		MemoryContext oldcontext = MemoryContextSwitchTo(acc->mcxt);
+		Datum		arg = val;
+		Datum		cur;
+		Datum		res = (Datum) 0;
+
+		if (acc->isint)
+		{
+			acc->nval = pllua_numeric_acc_int_numeric(acc->ival);
+			acc->isint = false;
+		}
+		cur = acc->nval;
+
+		if (isint)
+			arg = DirectFunctionCall1(int8_numeric, Int64GetDatumFast(ival));
+		else if (isnum)
+			arg = DirectFunctionCall1(float8_numeric, Float8GetDatumFast(fval));
+
+		switch (op)
+		{
+			case PLLUA_NUM_ADD:
+				res = DirectFunctionCall2(numeric_add, cur, arg);	break;
+			case PLLUA_NUM_SUB:
+				res = DirectFunctionCall2(numeric_sub, cur, arg);	break;
+			case PLLUA_NUM_MUL:
+				res = DirectFunctionCall2(numeric_mul, cur, arg);	break;
+			default:
+				elog(ERROR, "unexpected accumulator op %d", op);
+		}
+
+		acc->nval = res;
+		pfree(DatumGetPointer(cur));
+		if (isnum)
+			pfree(DatumGetPointer(arg));
+
+		MemoryContextSwitchTo(oldcontext);
+	}
+	PLLUA_CATCH_RETHROW();
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+/*
+ * acc:result()  returns a new Numeric datum
+ *
+ * upvalue 1 is the numeric typeinfo object
+ */
+static int
+pllua_numeric_acc_result(lua_State *L)
+{
+	pllua_numeric_acc *acc = pllua_checkobject(L, 1, PLLUA_NUMERIC_ACC_OBJECT);
+	pllua_typeinfo *t = pllua_totypeinfo(L, lua_upvalueindex(1));
+	pllua_datum *d = pllua_newdatum(L, lua_upvalueindex(1), (Datum)0);
+
+	PLLUA_TRY();
+	{
+		MemoryContext oldcontext;
+
+		if (acc->isint)
+			d->value = pllua_numeric_acc_int_numeric(acc->ival);
+		else
+			d->value = acc->nval;
+
+		oldcontext = MemoryContextSwitchTo(pllua_get_memory_cxt(L));
+		pllua_savedatum(L, d, t);
+		MemoryContextSwitchTo(oldcontext);
+	}
+	PLLUA_CATCH_RETHROW();
+
+	return 1;
+}
+
+static struct { const char *name; enum num_method_id id; } numeric_acc_methods[] = {
+	{ "add", PLLUA_NUM_ADD },
+	{ "sub", PLLUA_NUM_SUB },
+	{ "mul", PLLUA_NUM_MUL },
+	{ NULL, PLLUA_NUM_NONE }
+};
+
+static luaL_Reg numeric_acc_mt[] = {
+	{ NULL, NULL }
+};
+
 static struct { const char *name; enum num_method_id id; } numeric_meta[] = {
 	{ "__add", PLLUA_NUM_ADD },
 	{ "__sub", PLLUA_NUM_SUB },
@@ -414,6 +913,24 @@ int pllua_open_numeric(lua_State *L)
 	luaL_setfuncs(L, numeric_plain_methods, 3);
 	lua_pop(L, 1);
 
+	pllua_newmetatable(L, PLLUA_NUMERIC_ACC_OBJECT, numeric_acc_mt);
+	lua_newtable(L);
+	for (i = 0; numeric_acc_methods[i].name; ++i)
+	{
+		lua_pushvalue(L, 2);
+		lua_pushinteger(L, numeric_acc_methods[i].id);
+		lua_pushcclosure(L, pllua_numeric_acc_op, 2);
+		lua_setfield(L, -2, numeric_acc_methods[i].name);
+	}
+	lua_pushvalue(L, 2);
+	lua_pushcclosure(L, pllua_numeric_acc_result, 1);
+	lua_setfield(L, -2, "result");
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+
+	lua_pushcfunction(L, pllua_numeric_acc_new);
+	lua_setfield(L, 1, "accumulator");
+
 	lua_pushvalue(L, 1);
 	return 1;
 }
@@ -205,7 +205,7 @@ static int pllua_mcxtobject_gc(lua_State *L)
 	*p = NULL;
 	if (mcxt)
 	{
-		PLLUA_TRY();
+		PLLUA_TRY_NOSUBXACT();
 		{
 			MemoryContextDelete(mcxt);
 		}
@@ -675,7 +675,7 @@ void pllua_deactivate_thread(lua_State *L, pllua_func_activation *act, ExprConte
  */
 static void pllua_destroy_funcinfo(lua_State *L, pllua_function_info *obj)
 {
-	PLLUA_TRY();
+	PLLUA_TRY_NOSUBXACT();
 	{
 		/*
 		 * funcinfo is allocated in its own memory context (since we expect it
@@ -0,0 +1,478 @@
+/* pgfunc.c */
+
+#include "pllua.h"
+
+#include "access/htup_details.h"
+#include "catalog/objectaccess.h"
+#include "catalog/pg_collation.h"
+#include "catalog/pg_operator.h"
+#include "catalog/pg_proc.h"
+#include "catalog/pg_type.h"
+#include "miscadmin.h"
+#include "parser/parse_coerce.h"
+#include "parser/parse_oper.h"
+#include "utils/acl.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#if PG_VERSION_NUM >= 110000
+#include "utils/regproc.h"
+#endif
+#include "utils/syscache.h"
+
+/*
+ * Function handles: callable objects wrapping a single pg function (possibly
+ * one found as the implementation of an operator), resolved from the catalog
+ * once at creation time.
+ *
+ * The handle holds a pgfunc object (see objects.c) for the FmgrInfo, and a
+ * FunctionCallInfo allocated alongside it which is reused for each call.
+ * Results are computed in a scratch context which is reset on the next call,
+ * so calling a handle in a loop does not accumulate garbage; the result is
+ * always copied out (or converted to a lua value) before we return.
+ *
+ * If a handle is re-entered (the target function somehow calling back into
+ * lua which calls the same handle), the inner call uses a local fcinfo and
+ * the caller's memory context rather than trampling the outer call's state.
+ */
+
+typedef struct pllua_pgfunc_handle
+{
+	Oid			fnoid;
+	Oid			rettype;
+	Oid			collation;
+	bool		strict;
+	bool		busy;
+	int			nargs;
+	Oid			argtypes[FUNC_MAX_ARGS];
+	FmgrInfo   *fn;
+	FunctionCallInfo fcinfo;
+	MemoryContext scratch;
+} pllua_pgfunc_handle;
+
+/*
+ * Fetch the details of a function from the catalog, rejecting anything we
+ * can't call as a plain function. Since calls through the handle bypass the
+ * executor, the permission check it would have done is done here instead.
+ * Must be called in PG context.
+ */
+static void
+pllua_pgfunc_handle_resolve(Oid fnoid, int *nargs, Oid *argtypes,
+							Oid *rettype, bool *strict)
+{
+	HeapTuple	tup;
+	Form_pg_proc procform;
+	AclResult	aclresult;
+	bool		plain;
+
+	ASSERT_PG_CONTEXT;
+
+	aclresult = pg_proc_aclcheck(fnoid, GetUserId(), ACL_EXECUTE);
+	if (aclresult != ACLCHECK_OK)
+#if PG_VERSION_NUM >= 110000
+		aclcheck_error(aclresult, OBJECT_FUNCTION, get_func_name(fnoid));
+#else
+		aclcheck_error(aclresult, ACL_KIND_PROC, get_func_name(fnoid));
+#endif
+	InvokeFunctionExecuteHook(fnoid);
+
+	tup = SearchSysCache1(PROCOID, ObjectIdGetDatum(fnoid));
+	if (!HeapTupleIsValid(tup))
+		elog(ERROR, "cache lookup failed for function %u", fnoid);
+	procform = (Form_pg_proc) GETSTRUCT(tup);
+
+#if PG_VERSION_NUM >= 110000
+	plain = (procform->prokind == PROKIND_FUNCTION);
+#else
+	plain = !(procform->proisagg || procform->proiswindow);
+#endif
+	if (!plain)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("%s is not a plain function",
+						format_procedure(fnoid))));
+	if (procform->proretset)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-returning function %s cannot be called through a function handle",
+						format_procedure(fnoid))));
+
+	*nargs = procform->pronargs;
+	memcpy(argtypes, procform->proargtypes.values, *nargs * sizeof(Oid));
+	*rettype = procform->prorettype;
+	*strict = procform->proisstrict;
+
+	ReleaseSysCache(tup);
+}
+
+/*
+ * We have no way to construct values of pseudo-types from lua (and passing
+ * garbage to something taking "internal" would be bad), so insist that all
+ * the types be real ones. Polymorphic types must have been resolved by the
+ * caller. Must be called in PG context.
+ */
+static void
+pllua_pgfunc_handle_check_types(Oid fnoid, int nargs, Oid *argtypes, Oid rettype)
+{
+	int			i;
+
+	ASSERT_PG_CONTEXT;
+
+	for (i = 0; i < nargs; ++i)
+	{
+		if (get_typtype(argtypes[i]) == TYPTYPE_PSEUDO)
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("argument of type %s of function %s is not supported in a function handle",
+							format_type_be(argtypes[i]),
+							format_procedure(fnoid))));
+	}
+	if (rettype != VOIDOID && get_typtype(rettype) == TYPTYPE_PSEUDO)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("result of type %s of function %s is not supported in a function handle",
+						format_type_be(rettype),
+						format_procedure(fnoid))));
+}
+
+/*
+ * Push a new handle for the given function, which the caller has already
+ * resolved and checked. argtypes/rettype are the actual (non-polymorphic)
+ * types to use; name is only for display.
+ */
+static int
+pllua_pgfunc_handle_push(lua_State *L, Oid fnoid, int nargs, Oid *argtypes,
+						 Oid rettype, bool strict, const char *name)
+{
+	pllua_pgfunc_handle *h;
+	int			nh;
+	int			nf;
+
+	h = pllua_newobject(L, PLLUA_PGFUNC_HANDLE_OBJECT, sizeof(pllua_pgfunc_handle), true);
+	nh = lua_absindex(L, -1);
+	h->fnoid = fnoid;
+	h->rettype = rettype;
+	h->strict = strict;
+	h->nargs = nargs;
+	memcpy(h->argtypes, argtypes, nargs * sizeof(Oid));
+
+	pllua_pgfunc_new(L);
+	nf = lua_absindex(L, -1);
+
+	PLLUA_TRY();
+	{
+		FmgrInfo   *fn;
+		bool		collatable = type_is_collatable(rettype);
+		int			i;
+
+		for (i = 0; i < nargs && !collatable; ++i)
+			collatable = type_is_collatable(argtypes[i]);
+		h->collation = collatable ? DEFAULT_COLLATION_OID : InvalidOid;
+
+		fn = pllua_pgfunc_init(L, nf, fnoid, nargs, h->argtypes, rettype);
+		h->fcinfo = MemoryContextAllocZero(fn->fn_mcxt, sizeof(FunctionCallInfoData));
+		h->scratch = AllocSetContextCreate(fn->fn_mcxt,
+										   "pllua function handle scratch",
+										   ALLOCSET_SMALL_SIZES);
+		h->fn = fn;
+	}
+	PLLUA_CATCH_RETHROW();
+
+	pllua_set_user_field(L, nh, "pgfunc");
+	lua_pushstring(L, name);
+	pllua_set_user_field(L, nh, "name");
+
+	return 1;
+}
+
+/*
+ * pgtype.func(signature)
+ *
+ * signature is anything acceptable to regprocedure, e.g. 'lower(text)'.
+ */
+int
+pllua_pgfunc_handle_new(lua_State *L)
+{
+	const char *sig = luaL_checkstring(L, 1);
+	volatile Oid fnoid = InvalidOid;
+	volatile Oid rettype = InvalidOid;
+	volatile int nargs = 0;
+	volatile bool strict = false;
+	const char *volatile name = NULL;
+	Oid			argtypes[FUNC_MAX_ARGS];
+
+	PLLUA_TRY();
+	{
+		int			n;
+		Oid			rt;
+		bool		s;
+
+		fnoid = DatumGetObjectId(DirectFunctionCall1(regprocedurein,
+													 CStringGetDatum(sig)));
+		pllua_pgfunc_handle_resolve(fnoid, &n, argtypes, &rt, &s);
+		pllua_pgfunc_handle_check_types(fnoid, n, argtypes, rt);
+		nargs = n;
+		rettype = rt;
+		strict = s;
+		name = format_procedure(fnoid);
+	}
+	PLLUA_CATCH_RETHROW();
+
+	return pllua_pgfunc_handle_push(L, fnoid, nargs, argtypes, rettype, strict, name);
+}
+
+/*
+ * Operand type for pgtype.op: a typeinfo, a type name, or nil.
+ */
+static Oid
+pllua_pgfunc_optype(lua_State *L, int nd)
+{
+	pllua_typeinfo *t;
+
+	if (lua_isnil(L, nd))
+		return InvalidOid;
+	if (lua_type(L, nd) == LUA_TSTRING)
+	{
+		lua_pushcfunction(L, pllua_typeinfo_parsetype);
+		lua_pushvalue(L, nd);
+		lua_call(L, 1, 1);
+		if (lua_isnil(L, -1))
+			luaL_error(L, "unknown type \"%s\"", lua_tostring(L, nd));
+		lua_replace(L, nd);
+	}
+	t = pllua_checktypeinfo(L, nd, true);
+	return t->typeoid;
+}
+
+/*
+ * pgtype.op(opname, lefttype, righttype)
+ *
+ * opname may be schema-qualified; lefttype is nil for a prefix operator.
+ * Operator resolution is as for an expression "left OP right" with operands
+ * of the given types, so implicit coercions and polymorphic operators (e.g.
+ * on ranges) work as they do in SQL. The result is a function handle for the
+ * operator's underlying function.
+ */
+int
+pllua_pgfunc_op_new(lua_State *L)
+{
+	const char *opname = luaL_checkstring(L, 1);
+	Oid			ltype;
+	Oid			rtype;
+	volatile Oid fnoid = InvalidOid;
+	volatile Oid rettype = InvalidOid;
+	volatile int nargs = 0;
+	volatile bool strict = false;
+	const char *volatile name = NULL;
+	Oid			argtypes[FUNC_MAX_ARGS];
+
+	lua_settop(L, 3);
+	ltype = pllua_pgfunc_optype(L, 2);
+	rtype = pllua_pgfunc_optype(L, 3);
+	if (!OidIsValid(rtype))
+		luaL_argerror(L, 3, "right operand type is required");
+
+	PLLUA_TRY();
+	{
+		const char *dot = strrchr(opname, '.');
+		List	   *names;
+		Operator	optup;
+		Oid			opoid;
+		Oid			optypes[2];
+		Oid			declared[FUNC_MAX_ARGS];
+		int			n;
+		Oid			rt;
+		bool		s;
+		int			i;
+
+		/* operator names can't contain '.', so the last one is the qualifier */
+		if (dot)
+			names = list_make2(makeString(pnstrdup(opname, dot - opname)),
+							   makeString(pstrdup(dot + 1)));
+		else
+			names = list_make1(makeString(pstrdup(opname)));
+
+		if (OidIsValid(ltype))
+			optup = oper(NULL, names, ltype, rtype, false, -1);
+		else
+			optup = left_oper(NULL, names, rtype, false, -1);
+		opoid = oprid(optup);
+		fnoid = ((Form_pg_operator) GETSTRUCT(optup))->oprcode;
+		ReleaseSysCache(optup);
+
+		if (!OidIsValid(fnoid))
+			elog(ERROR, "operator %s is only a shell", format_operator(opoid));
+
+		pllua_pgfunc_handle_resolve(fnoid, &n, declared, &rt, &s);
+
+		optypes[0] = OidIsValid(ltype) ? ltype : rtype;
+		optypes[1] = rtype;
+		if (n != (OidIsValid(ltype) ? 2 : 1))
+			elog(ERROR, "function %s for operator %s has the wrong number of arguments",
+				 format_procedure(fnoid), format_operator(opoid));
+
+		/*
+		 * Polymorphic inputs take the operand types we were given; anything
+		 * else is converted to the declared type at call time.
+		 */
+		for (i = 0; i < n; ++i)
+			argtypes[i] = IsPolymorphicType(declared[i]) ? optypes[i] : declared[i];
+		rt = enforce_generic_type_consistency(argtypes, declared, n, rt, false);
+
+		pllua_pgfunc_handle_check_types(fnoid, n, argtypes, rt);
+		nargs = n;
+		rettype = rt;
+		strict = s;
+		name = psprintf("operator %s", format_operator(opoid));
+	}
+	PLLUA_CATCH_RETHROW();
+
+	return pllua_pgfunc_handle_push(L, fnoid, nargs, argtypes, rettype, strict, name);
+}
+
+/*
+ * __call(self, args...)
+ */
+static int
+pllua_pgfunc_handle_call(lua_State *L)
+{
+	pllua_pgfunc_handle *h = pllua_checkobject(L, 1, PLLUA_PGFUNC_HANDLE_OBJECT);
+	int			nargs = lua_gettop(L) - 1;
+	int			argbase = 2;
+	Datum		values[FUNC_MAX_ARGS];
+	bool		isnull[FUNC_MAX_ARGS];
+	bool		anynull = false;
+	pllua_typeinfo *rt = NULL;
+	int			nrt = 0;
+	volatile Datum res = (Datum) 0;
+	volatile bool resnull = false;
+	int			i;
+
+	if (nargs != h->nargs)
+		luaL_error(L, "wrong number of arguments to function handle (expected %d, got %d)",
+				   h->nargs, nargs);
+
+	luaL_checkstack(L, 10, NULL);
+
+	/* holds references to the argument datums for the duration of the call */
+	lua_createtable(L, nargs, 0);
+
+	for (i = 0; i < nargs; ++i)
+	{
+		if (!lua_isnil(L, argbase+i))
+		{
+			pllua_typeinfo *dt;
+			pllua_datum *d;
+			lua_pushvalue(L, argbase+i);
+			d = pllua_toanydatum(L, -1, &dt);
+			/* not already an unexploded datum of correct type? */
+			if (!d ||
+				dt->typeoid != h->argtypes[i] ||
+				dt->obsolete || dt->modified ||
+				d->modified)
+			{
+				if (d)
+					lua_pop(L, 1);  /* discard typeinfo */
+				lua_pushcfunction(L, pllua_typeinfo_lookup);
+				lua_pushinteger(L, (lua_Integer) h->argtypes[i]);
+				lua_call(L, 1, 1);
+				lua_insert(L, -2);
+				lua_call(L, 1, 1);
+				d = pllua_toanydatum(L, -1, &dt);
+			}
+			if (!d || dt->typeoid != h->argtypes[i])
+				luaL_error(L, "inconsistent value type in function handle argument %d", i+1);
+			lua_pop(L, 1); /* discard typeinfo */
+			lua_rawseti(L, argbase+nargs, i+1);
+			values[i] = d->value;
+			isnull[i] = false;
+		}
+		else
+		{
+			values[i] = (Datum) 0;
+			isnull[i] = true;
+			anynull = true;
+		}
+	}
+
+	if (h->strict && anynull)
+	{
+		lua_pushnil(L);
+		return 1;
+	}
+
+	if (h->rettype != VOIDOID)
+	{
+		lua_pushcfunction(L, pllua_typeinfo_lookup);
+		lua_pushinteger(L, (lua_Integer) h->rettype);
+		lua_call(L, 1, 1);
+		rt = pllua_checktypeinfo(L, -1, true);
+		nrt = lua_absindex(L, -1);
+	}
+
+	PLLUA_TRY();
+	{
+		FunctionCallInfoData local_fcinfo;
+		FunctionCallInfo fcinfo = h->fcinfo;
+		bool		nested = h->busy;
+		MemoryContext oldcontext = CurrentMemoryContext;
+
+		if (nested)
+			fcinfo = &local_fcinfo;
+		else
+		{
+			MemoryContextReset(h->scratch);
+			MemoryContextSwitchTo(h->scratch);
+		}
+
+		InitFunctionCallInfoData(*fcinfo, h->fn, nargs, h->collation, NULL, NULL);
+		for (i = 0; i < nargs; ++i)
+		{
+			fcinfo->arg[i] = values[i];
+			fcinfo->argnull[i] = isnull[i];
+		}
+
+		h->busy = true;
+		PG_TRY();
+		{
+			res = FunctionCallInvoke(fcinfo);
+			resnull = fcinfo->isnull;
+		}
+		PG_CATCH();
+		{
+			h->busy = nested;
+			PG_RE_THROW();
+		}
+		PG_END_TRY();
+		h->busy = nested;
+
+		MemoryContextSwitchTo(oldcontext);
+	}
+	PLLUA_CATCH_RETHROW();
+
+	if (!rt)
+		return 0;
+
+	return pllua_datum_single(L, res, resnull, nrt, rt);
+}
+
+static int
+pllua_pgfunc_handle_tostring(lua_State *L)
+{
+	pllua_checkobject(L, 1, PLLUA_PGFUNC_HANDLE_OBJECT);
+	pllua_get_user_field(L, 1, "name");
+	lua_pushfstring(L, "function handle: %s", lua_tostring(L, -1));
+	return 1;
+}
+
+static struct luaL_Reg pgfunc_handle_mt[] = {
+	{ "__call", pllua_pgfunc_handle_call },
+	{ "__tostring", pllua_pgfunc_handle_tostring },
+	{ NULL, NULL }
+};
+
+void
+pllua_init_pgfunc_handles(lua_State *L)
+{
+	pllua_newmetatable(L, PLLUA_PGFUNC_HANDLE_OBJECT, pgfunc_handle_mt);
+	lua_pop(L, 1);
+}
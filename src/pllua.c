@@ -7,8 +7,19 @@
 
 #include "pllua.h"
 
+#include "access/htup_details.h"
+#include "catalog/pg_language.h"
+#include "catalog/pg_proc.h"
+#include "catalog/pg_type.h"
 #include "commands/event_trigger.h"
 #include "commands/trigger.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#if PG_VERSION_NUM >= 110000
+#include "utils/regproc.h"
+#endif
+#include "utils/syscache.h"
 
 PG_MODULE_MAGIC;
 
@@ -23,10 +34,13 @@ PGDLLEXPORT Datum pllua_inline_handler(PG_FUNCTION_ARGS);
 PGDLLEXPORT Datum plluau_validator(PG_FUNCTION_ARGS);
 PGDLLEXPORT Datum plluau_call_handler(PG_FUNCTION_ARGS);
 PGDLLEXPORT Datum plluau_inline_handler(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum pllua_warmup_functions(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum plluau_warmup_functions(PG_FUNCTION_ARGS);
 
 static Datum pllua_common_call(FunctionCallInfo fcinfo, bool trusted);
 static Datum pllua_common_inline(FunctionCallInfo fcinfo, bool trusted);
 static Datum pllua_common_validator(FunctionCallInfo fcinfo, bool trusted);
+static Datum pllua_common_warmup(FunctionCallInfo fcinfo, bool trusted);
 
 
 /* Trusted entry points */
@@ -49,6 +63,12 @@ Datum pllua_inline_handler(PG_FUNCTION_ARGS)
 	return pllua_common_inline(fcinfo, true);
 }
 
+PG_FUNCTION_INFO_V1(pllua_warmup_functions);
+Datum pllua_warmup_functions(PG_FUNCTION_ARGS)
+{
+	return pllua_common_warmup(fcinfo, true);
+}
+
 /* Untrusted entry points */
 
 PG_FUNCTION_INFO_V1(plluau_validator);
@@ -69,6 +89,12 @@ Datum plluau_inline_handler(PG_FUNCTION_ARGS)
 	return pllua_common_inline(fcinfo, false);
 }
 
+PG_FUNCTION_INFO_V1(plluau_warmup_functions);
+Datum plluau_warmup_functions(PG_FUNCTION_ARGS)
+{
+	return pllua_common_warmup(fcinfo, false);
+}
+
 /* Common implementations */
 
 Datum pllua_common_call(FunctionCallInfo fcinfo, bool trusted)
@@ -107,7 +133,14 @@ Datum pllua_common_call(FunctionCallInfo fcinfo, bool trusted)
 		error_context_stack = &ecxt;
 
 		if (funcact && funcact->thread)
+		{
+			/*
+			 * Not going through pllua_getstate, so catch up on any
+			 * invalidations that arrived since the previous row.
+			 */
 			act.interp = funcact->interp;
+			pllua_check_invalidations(act.interp);
+		}
 		else
 			act.interp = pllua_getstate(trusted, &act);
 
@@ -242,3 +275,120 @@ Datum pllua_common_inline(FunctionCallInfo fcinfo, bool trusted)
 
 	PG_RETURN_VOID();
 }
+
+/*
+ * Check that the function is one of ours, in the right trust mode, by looking
+ * at what its language's call handler actually is.
+ */
+static void
+pllua_warmup_check_language(Oid funcoid, bool trusted)
+{
+	HeapTuple	procTup;
+	HeapTuple	langTup;
+	Oid			langoid;
+	Oid			handleroid;
+	FmgrInfo	flinfo;
+
+	procTup = SearchSysCache1(PROCOID, ObjectIdGetDatum(funcoid));
+	if (!HeapTupleIsValid(procTup))
+		elog(ERROR, "cache lookup failed for function %u", funcoid);
+	langoid = ((Form_pg_proc) GETSTRUCT(procTup))->prolang;
+	ReleaseSysCache(procTup);
+
+	langTup = SearchSysCache1(LANGOID, ObjectIdGetDatum(langoid));
+	if (!HeapTupleIsValid(langTup))
+		elog(ERROR, "cache lookup failed for language %u", langoid);
+	handleroid = ((Form_pg_language) GETSTRUCT(langTup))->lanplcallfoid;
+	ReleaseSysCache(langTup);
+
+	if (OidIsValid(handleroid))
+		fmgr_info(handleroid, &flinfo);
+
+	if (!OidIsValid(handleroid) ||
+		flinfo.fn_addr != (trusted ? pllua_call_handler : plluau_call_handler))
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("function %s is not a %s function",
+						format_procedure(funcoid),
+						trusted ? "PL/Lua" : "PL/LuaU")));
+}
+
+/*
+ * Compile each function in the regprocedure[] argument into the interpreter
+ * that calls from the current user would use, so that the first real call
+ * skips the compile. Returns the number of functions that actually needed
+ * compiling.
+ */
+Datum pllua_common_warmup(FunctionCallInfo fcinfo, bool trusted)
+{
+	pllua_interpreter *volatile interp = NULL;
+	pllua_activation_record act;
+	ArrayType  *arr = PG_GETARG_ARRAYTYPE_P(0);
+	Datum	   *elems;
+	bool	   *nulls;
+	int			nelems;
+	int			i;
+	volatile int32 ncompiled = 0;
+	ErrorContextCallback ecxt;
+
+	deconstruct_array(arr, REGPROCEDUREOID,
+					  sizeof(Oid), true, 'i',
+					  &elems, &nulls, &nelems);
+
+	/* check everything before doing anything */
+	for (i = 0; i < nelems; ++i)
+	{
+		if (!nulls[i])
+			pllua_warmup_check_language(DatumGetObjectId(elems[i]), trusted);
+	}
+
+	act.fcinfo = NULL;
+	act.retval = (Datum) 0;
+	act.atomic = true;
+	act.trusted = trusted;
+	act.cblock = NULL;
+	act.validate_func = InvalidOid;
+	act.interp = NULL;
+	act.active_error = LUA_REFNIL;
+	act.err_text = NULL;
+
+	pllua_setcontext(PLLUA_CONTEXT_PG);
+
+	/*
+	 * this catch block exists to save/restore the error context stack and
+	 * allow cleanup of our internal error state when returning to PG proper
+	 */
+	PG_TRY();
+	{
+		ecxt.callback = pllua_error_callback;
+		ecxt.arg = &act;
+		ecxt.previous = error_context_stack;
+		error_context_stack = &ecxt;
+
+		for (i = 0; i < nelems; ++i)
+		{
+			if (nulls[i])
+				continue;
+
+			act.validate_func = DatumGetObjectId(elems[i]);
+			act.retval = (Datum) 0;
+
+			if (!interp)
+				interp = act.interp = pllua_getstate(trusted, &act);
+
+			pllua_initial_protected_call(act.interp, pllua_warmup, &act);
+
+			if (DatumGetBool(act.retval))
+				++ncompiled;
+		}
+	}
+	PG_CATCH();
+	{
+		if (interp)
+			pllua_error_cleanup(interp, &act);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	PG_RETURN_INT32(ncompiled);
+}
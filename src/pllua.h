@@ -107,8 +107,23 @@ pllua_setcontext(pllua_context_type newctx)
 
 /*
  * Abbreviate the most common form of catch block.
+ *
+ * Entering PG context is what forces any subtransactions deferred by pcall to
+ * actually be started (see error.c). The _NOSUBXACT variant skips that, and is
+ * only for places that do nothing needing to be rolled back: the interrupt
+ * hook, and finalizers or cleanup paths that only free memory. Otherwise any
+ * garbage collection step could start a subtransaction.
  */
 #define PLLUA_TRY() do {												\
+	pllua_context_type _pllua_oldctx;									\
+	MemoryContext _pllua_oldmcxt;										\
+	if (pllua_pending_subxacts > 0)										\
+		pllua_start_pending_subxacts(L);								\
+	_pllua_oldctx = pllua_setcontext(PLLUA_CONTEXT_PG);					\
+	_pllua_oldmcxt = CurrentMemoryContext;								\
+	PG_TRY()
+
+#define PLLUA_TRY_NOSUBXACT() do {										\
 	pllua_context_type _pllua_oldctx = pllua_setcontext(PLLUA_CONTEXT_PG); \
 	MemoryContext _pllua_oldmcxt = CurrentMemoryContext;				\
 	PG_TRY()
@@ -156,8 +171,8 @@ typedef struct pllua_cache_inval
 	bool		inval_type;
 	bool		inval_rel;
 	bool		inval_cast;
-	Oid			inval_typeoid;
-	Oid			inval_reloid;
+	uint32		inval_typhash;	/* TYPEOID hash value, or 0 for all */
+	Oid			inval_reloid;	/* or InvalidOid for all */
 } pllua_cache_inval;
 
 /*
@@ -185,6 +200,12 @@ typedef struct pllua_interpreter
 	bool		update_errdepth;
 
 	pllua_cache_inval *inval;
+
+	/* invalidation generations seen, see init.c */
+	uint64		type_generation;
+	uint64		rel_generation;
+	uint64		cast_generation;
+	int			active_depth;	/* nesting of pllua_initial_protected_call */
 } pllua_interpreter;
 
 /* We abuse the node system to pass this in fcinfo->context */
@@ -311,6 +332,19 @@ typedef struct pllua_datum
 	bool		modified;		/* composite value has been exploded */
 } pllua_datum;
 
+/*
+ * Direct transform callbacks, see pllua_register_fromsql_transform.
+ *
+ * A fromsql callback pushes one Lua value for "val" and returns 1, or pushes
+ * nothing and returns 0 to decline. A tosql callback converts the "nargs"
+ * values starting at stack index "argbase", setting *result and *isnull and
+ * returning true, or returns false to decline. Both are called in Lua context,
+ * so any PG calls they make must be inside PLLUA_TRY.
+ */
+typedef int (*pllua_fromsql_transform_fn) (lua_State *L, Datum val);
+typedef bool (*pllua_tosql_transform_fn) (lua_State *L, int nargs, int argbase,
+										  Datum *result, bool *isnull);
+
 /*
  * Stuff we store about types. Datum values reference this from their
  * metatables (in fact the metatable of the Datum is the uservalue of
@@ -329,6 +363,7 @@ typedef struct pllua_typeinfo
 	Oid			basetype;	/* for domains */
 	Oid			elemtype;	/* for arrays */
 	Oid			rangetype;	/* for ranges */
+	uint32		typhash;	/* TYPEOID syscache hash value of typeoid */
 	bool		hasoid;
 	bool		is_array;
 	bool		is_range;
@@ -371,6 +406,8 @@ typedef struct pllua_typeinfo
 
 	Oid			fromsql;		/* fromsql(internal) returns internal */
 	Oid			tosql;			/* tosql(internal) returns datum */
+	pllua_fromsql_transform_fn fromsql_direct;	/* registered C callbacks */
+	pllua_tosql_transform_fn tosql_direct;
 
 	/*
 	 * we give this its own context, because we can't control what fmgr will
@@ -409,6 +446,7 @@ extern bool pllua_ending;
  * reg[PLLUA_TYPES] = { [integer oid] = typeinfo object }
  * reg[PLLUA_RECORDS] = { [integer typmod] = typeinfo object }
  * reg[PLLUA_PORTALS] = { [light(Portal)] = cursor object }
+ * reg[PLLUA_INLINE_CACHE] = { [source string] = { bytecode string, lru stamp } }
  *
  * metatables:
  * reg[PLLUA_FUNCTION_OBJECT]
@@ -439,6 +477,7 @@ extern char PLLUA_TYPES[];
 extern char PLLUA_RECORDS[];
 extern char PLLUA_ACTIVATIONS[];
 extern char PLLUA_PORTALS[];
+extern char PLLUA_INLINE_CACHE[];
 extern char PLLUA_FUNCTION_OBJECT[];
 extern char PLLUA_ERROR_OBJECT[];
 extern char PLLUA_IDXLIST_OBJECT[];
@@ -452,6 +491,14 @@ extern char PLLUA_TRIGGER_OBJECT[];
 extern char PLLUA_EVENT_TRIGGER_OBJECT[];
 extern char PLLUA_SPI_STMT_OBJECT[];
 extern char PLLUA_SPI_CURSOR_OBJECT[];
+extern char PLLUA_HASHMAP_OBJECT[];
+extern char PLLUA_NUMERIC_ACC_OBJECT[];
+extern char PLLUA_JSONB_PROXY_OBJECT[];
+extern char PLLUA_JSONB_ITER_OBJECT[];
+extern char PLLUA_JSONB_PATH_OBJECT[];
+extern char PLLUA_PGFUNC_HANDLE_OBJECT[];
+extern char PLLUA_JSON_OBJECT_MT[];
+extern char PLLUA_JSON_ARRAY_MT[];
 extern char PLLUA_LAST_ERROR[];
 extern char PLLUA_RECURSIVE_ERROR[];
 extern char PLLUA_FUNCTION_MEMBER[];
@@ -473,11 +520,19 @@ extern char PLLUA_SANDBOX_META[];
 /* init.c */
 
 pllua_interpreter *pllua_getstate(bool trusted, pllua_activation_record *act);
+void pllua_check_invalidations(pllua_interpreter *interp_desc);
 pllua_interpreter *pllua_getinterpreter(lua_State *L);
 int pllua_set_new_ident(lua_State *L);
 void pllua_run_extra_gc(lua_State *L, unsigned long gc_debt);
+bool pllua_memory_limit_exceeded(lua_State *L);
+int pllua_memory_stats(lua_State *L);
 
 extern bool pllua_track_gc_debt;
+extern bool pllua_native_types;
+extern bool pllua_bytecode_cache;
+extern char *pllua_preload_functions;
+extern int pllua_inline_cache_size;
+extern int pllua_active_interpreters;
 
 /*
  * This is a macro because we want to avoid executing (sz_) at all if not tracking
@@ -501,6 +556,8 @@ void pllua_compile_inline(lua_State *L, const char *str, bool trusted);
 int pllua_compile(lua_State *L);
 int pllua_intern_function(lua_State *L);
 void pllua_validate_function(lua_State *L, Oid fn_oid, bool trusted);
+bool pllua_preload_function(lua_State *L, Oid fn_oid, bool trusted);
+int pllua_preload_function_list(lua_State *L);
 
 /* datum.c */
 int pllua_open_pgtype(lua_State *L);
@@ -543,6 +600,12 @@ void pllua_typeinfo_check_domain(lua_State *L,
 								 Datum *val, bool *isnull, int32 typmod,
 								 int nt, pllua_typeinfo *t);
 
+/* These are DLLEXPORT so that transform modules can get at them */
+PGDLLEXPORT void pllua_register_fromsql_transform(PGFunction func,
+												  pllua_fromsql_transform_fn fn);
+PGDLLEXPORT void pllua_register_tosql_transform(PGFunction func,
+												pllua_tosql_transform_fn fn);
+
 /* elog.c */
 int pllua_open_elog(lua_State *L);
 int pllua_open_print(lua_State *L);
@@ -571,6 +634,10 @@ PGDLLEXPORT int pllua_pcall_nothrow(lua_State *L, int nargs, int nresults, int m
 PGDLLEXPORT int pllua_cpcall(lua_State *L, lua_CFunction func, void* arg);
 PGDLLEXPORT void pllua_pcall(lua_State *L, int nargs, int nresults, int msgh);
 PGDLLEXPORT int pllua_trampoline(lua_State *L);
+PGDLLEXPORT void pllua_call_pg(lua_State *L, void (*func)(void *), void *arg);
+
+extern int pllua_pending_subxacts;
+void pllua_start_pending_subxacts(lua_State *L);
 
 void pllua_initial_protected_call(pllua_interpreter *interp,
 								  lua_CFunction func,
@@ -590,6 +657,13 @@ int pllua_call_trigger(lua_State *L);
 int pllua_call_event_trigger(lua_State *L);
 int pllua_call_inline(lua_State *L);
 int pllua_validate(lua_State *L);
+int pllua_warmup(lua_State *L);
+
+/* hashmap.c */
+int pllua_open_hashmap(lua_State *L);
+
+/* json.c */
+int pllua_open_json(lua_State *L);
 
 /* jsonb.c */
 int pllua_open_jsonb(lua_State *L);
@@ -600,6 +674,9 @@ int pllua_open_numeric(lua_State *L);
 /* objects.c */
 int pllua_open_funcmgr(lua_State *L);
 
+/* temporal.c */
+int pllua_open_temporal(lua_State *L);
+
 /* These are DLLEXPORT so that transform modules can get at them */
 PGDLLEXPORT bool pllua_is_container(lua_State *L, int nd);
 PGDLLEXPORT bool pllua_pairs_start(lua_State *L, int nd, bool noerror);
@@ -644,6 +721,11 @@ void pllua_pgfunc_new(lua_State *L);
 FmgrInfo *pllua_pgfunc_init(lua_State *L, int nd, Oid fnoid, int nargs, Oid *argtypes, Oid rettype);
 void pllua_pgfunc_table_new(lua_State *L);
 
+/* pgfunc.c */
+int pllua_pgfunc_handle_new(lua_State *L);
+int pllua_pgfunc_op_new(lua_State *L);
+void pllua_init_pgfunc_handles(lua_State *L);
+
 /* preload.c */
 int pllua_preload_compat(lua_State *L);
 
@@ -652,6 +734,7 @@ int pllua_open_spi(lua_State *L);
 
 int pllua_spi_convert_args(lua_State *L);
 int pllua_spi_prepare_result(lua_State *L);
+int pllua_spi_batch_reject(lua_State *L);
 int pllua_cursor_cleanup_portal(lua_State *L);
 
 int pllua_spi_newcursor(lua_State *L);
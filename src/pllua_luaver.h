@@ -44,6 +44,15 @@
  */
 #define pllua_register_cfunc(L_, f_) (f_)
 
+/*
+ * lua_dump gained a "strip" parameter in 5.3.
+ */
+#if LUA_VERSION_NUM < 503
+#define pllua_dump(L_,w_,d_) lua_dump(L_,w_,d_)
+#else
+#define pllua_dump(L_,w_,d_) lua_dump(L_,w_,d_,0)
+#endif
+
 /*
  * Function to use to set an environment on a code chunk.
  */
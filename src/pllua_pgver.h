@@ -67,6 +67,11 @@
 #define TupleDescAttr(tupdesc, i) ((tupdesc)->attrs[(i)])
 #endif
 
+/* hash support function renumbering */
+#if PG_VERSION_NUM < 110000
+#define HASHSTANDARD_PROC HASHPROC
+#endif
+
 /* AllocSetContextCreate API changes */
 #if PG_VERSION_NUM < 110000
 #define AllocSetContextCreateInternal AllocSetContextCreate
@@ -684,6 +684,248 @@ static int pllua_spi_execute(lua_State *L)
 	return lua_gettop(L);
 }
 
+/*
+ * Error-tolerant batch execution.
+ *
+ * Rows are executed in chunks, each under a single subtransaction; if a chunk
+ * fails at some row, the rows before it are redone as a (shorter) chunk, and
+ * the failing row is then retried on its own and recorded as rejected if it
+ * fails again. So a batch with few bad rows costs a small number of
+ * subtransactions rather than one per row.
+ */
+
+#define DEFAULT_BATCH_CHUNK 100
+
+typedef struct pllua_spi_batch
+{
+	pllua_spi_statement *stmt;
+	ParamListInfo paramLI;
+	Datum	   *values;
+	bool	   *isnull;
+	bool		readonly;
+	uint64		processed;
+} pllua_spi_batch;
+
+/*
+ * Execute rows [start,end) in a subtransaction. Returns end on success (the
+ * subtransaction is committed), otherwise the index of the failing row, with
+ * the error in *edata and everything rolled back. PG context.
+ */
+static int
+pllua_spi_batch_range(pllua_spi_batch *batch, int start, int end,
+					  ErrorData **edata)
+{
+	MemoryContext oldcontext = CurrentMemoryContext;
+	ResourceOwner oldowner = CurrentResourceOwner;
+	int			nparams = batch->stmt->nparams;
+	volatile int row = start;
+	volatile uint64 processed = 0;
+	volatile bool failed = false;
+
+	BeginInternalSubTransaction(NULL);
+	MemoryContextSwitchTo(oldcontext);
+
+	PG_TRY();
+	{
+		for (; row < end; ++row)
+		{
+			int			i;
+			int			rc;
+
+			for (i = 0; i < nparams; ++i)
+			{
+				ParamExternData *prm = &batch->paramLI->params[i];
+
+				prm->value = batch->values[row * nparams + i];
+				prm->isnull = batch->isnull[row * nparams + i];
+			}
+			rc = SPI_execute_plan_with_paramlist(batch->stmt->plan, batch->paramLI,
+												 batch->readonly, 0);
+			if (rc < 0)
+				elog(ERROR, "spi error: %s", SPI_result_code_string(rc));
+			processed += SPI_processed;
+			SPI_freetuptable(SPI_tuptable);
+		}
+
+		ReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcontext);
+		CurrentResourceOwner = oldowner;
+	}
+	PG_CATCH();
+	{
+		MemoryContextSwitchTo(oldcontext);
+		*edata = CopyErrorData();
+		FlushErrorState();
+
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcontext);
+		CurrentResourceOwner = oldowner;
+
+		/* don't let a cancel be treated as a bad row */
+		if ((*edata)->sqlerrcode == ERRCODE_QUERY_CANCELED ||
+			(*edata)->sqlerrcode == ERRCODE_ADMIN_SHUTDOWN)
+			ReThrowError(*edata);
+
+		failed = true;
+	}
+	PG_END_TRY();
+
+	if (failed)
+		return row;
+
+	batch->processed += processed;
+	return end;
+}
+
+/*
+ * rejects, row, edata (lightuserdata)
+ *
+ * The strings are built here rather than by the caller, which is in PG
+ * context and so can't risk a lua memory error.
+ */
+int
+pllua_spi_batch_reject(lua_State *L)
+{
+	ErrorData  *edata = lua_touserdata(L, 3);
+
+	lua_createtable(L, 0, 3);
+	lua_pushvalue(L, 2);
+	lua_setfield(L, -2, "row");
+	lua_pushstring(L, unpack_sql_state(edata->sqlerrcode));
+	lua_setfield(L, -2, "sqlstate");
+	lua_pushstring(L, edata->message ? edata->message : "");
+	lua_setfield(L, -2, "message");
+	lua_rawseti(L, 1, luaL_len(L, 1) + 1);
+	return 0;
+}
+
+/*
+ * stmt:execute_batch(rows [, opts]) returns rejects, nprocessed
+ *
+ * rows is a sequence of parameter lists, each indexed 1..stmt:numargs() (nil
+ * entries are nulls). All parameters are converted before anything is
+ * executed, so a conversion error fails the whole call. opts.chunk sets the
+ * number of rows per subtransaction.
+ *
+ * rejects is a sequence of { row = i, sqlstate = "xxxxx", message = "..." }
+ * for rows that failed; nprocessed is the total row count processed by the
+ * successful executions.
+ */
+static int pllua_spi_execute_batch(lua_State *L)
+{
+	pllua_spi_statement *stmt = *pllua_checkrefobject(L, 1, PLLUA_SPI_STMT_OBJECT);
+	lua_Integer nrows;
+	lua_Integer chunk = DEFAULT_BATCH_CHUNK;
+	int			nparams = stmt->nparams;
+	Datum	   *values;
+	bool	   *isnull;
+	volatile uint64 processed = 0;
+	int			rejects;
+	int			i;
+	int			j;
+
+	luaL_checktype(L, 2, LUA_TTABLE);
+	lua_settop(L, 3);
+	if (!lua_isnil(L, 3))
+	{
+		luaL_checktype(L, 3, LUA_TTABLE);
+		if (lua_getfield(L, 3, "chunk") != LUA_TNIL)
+		{
+			chunk = luaL_checkinteger(L, -1);
+			if (chunk < 1)
+				luaL_error(L, "chunk size must be positive");
+		}
+		lua_pop(L, 1);
+	}
+
+	if (pllua_ending)
+		luaL_error(L, "cannot call SPI during shutdown");
+
+	nrows = luaL_len(L, 2);
+	if (nrows > INT_MAX / Max(nparams, 1) ||
+		(Size) nrows * Max(nparams, 1) > MaxAllocSize / sizeof(Datum))
+		luaL_error(L, "too many rows in batch");
+
+	luaL_checkstack(L, 40 + nparams, NULL);
+
+	values = lua_newuserdata(L, nrows * nparams * sizeof(Datum) + 1);
+	isnull = lua_newuserdata(L, nrows * nparams * sizeof(bool) + 1);
+	/* refs to all the converted datums */
+	lua_createtable(L, (int) nrows, 0);
+
+	for (i = 0; i < nrows; ++i)
+	{
+		if (lua_rawgeti(L, 2, i+1) != LUA_TTABLE)
+			luaL_error(L, "row %d of batch is not a table", i+1);
+		lua_pushcfunction(L, pllua_spi_convert_args);
+		lua_pushlightuserdata(L, &values[i * nparams]);
+		lua_pushlightuserdata(L, &isnull[i * nparams]);
+		lua_pushlightuserdata(L, stmt->param_types);
+		lua_createtable(L, nparams, 0);
+		lua_pushvalue(L, -1);
+		lua_rawseti(L, -8, i+1);
+		for (j = 0; j < nparams; ++j)
+			lua_rawgeti(L, -6 - j, j+1);
+		lua_call(L, 4 + nparams, 0);
+		lua_pop(L, 1);
+	}
+
+	lua_newtable(L);
+	rejects = lua_absindex(L, -1);
+
+	PLLUA_TRY();
+	{
+		pllua_spi_batch batch;
+		int			pos = 0;
+		int			limit = -1;
+
+		batch.stmt = stmt;
+		batch.values = values;
+		batch.isnull = isnull;
+		batch.processed = 0;
+		batch.readonly = pllua_spi_enter(L);
+		batch.paramLI = pllua_spi_init_paramlist(nparams, values, isnull,
+												 stmt->param_types);
+
+		while (pos < nrows)
+		{
+			ErrorData  *edata = NULL;
+			int			end = (int) Min(pos + chunk, nrows);
+			int			fail;
+
+			if (limit > pos && limit < end)
+				end = limit;
+
+			fail = pllua_spi_batch_range(&batch, pos, end, &edata);
+			if (fail == end)
+				pos = end;
+			else if (fail == pos)
+			{
+				pllua_pushcfunction(L, pllua_spi_batch_reject);
+				lua_pushvalue(L, rejects);
+				lua_pushinteger(L, pos + 1);
+				lua_pushlightuserdata(L, edata);
+				pllua_pcall(L, 3, 0, 0);
+				++pos;
+			}
+			else
+			{
+				/* rows before the failure were fine; redo just those */
+				limit = fail;
+			}
+			if (edata)
+				FreeErrorData(edata);
+		}
+
+		processed = batch.processed;
+		pllua_spi_exit(L);
+	}
+	PLLUA_CATCH_RETHROW();
+
+	lua_pushinteger(L, (lua_Integer) processed);
+	return 2;
+}
+
 /*
  * c:open(cmd, arg...)
  * c:open(stmt, arg...)
@@ -953,7 +1195,7 @@ static int pllua_stmt_gc(lua_State *L)
 	if (!stmt)
 		return 0;
 
-	PLLUA_TRY();
+	PLLUA_TRY_NOSUBXACT();
 	{
 		if (stmt->kept && stmt->plan)
 			SPI_freeplan(stmt->plan);
@@ -1482,6 +1724,7 @@ static struct luaL_Reg spi_stmt_methods[] = {
 	{ "issaved", pllua_spi_noop_true },
 	{ "execute", pllua_spi_execute },
 	{ "execute_count", pllua_spi_execute_count },
+	{ "execute_batch", pllua_spi_execute_batch },
 	{ "getcursor", pllua_spi_stmt_getcursor },
 	{ "rows", pllua_spi_stmt_rows },
 	{ "numargs", pllua_stmt_numargs },
@@ -0,0 +1,535 @@
+/* temporal.c */
+
+#include "pllua.h"
+
+#include "catalog/pg_type.h"
+#include "utils/builtins.h"
+#include "utils/date.h"
+#include "utils/timestamp.h"
+
+/*
+ * Arithmetic and comparison for timestamp, timestamptz, date and interval
+ * datums, done by calling the types' own support functions directly, as the
+ * numeric module does for numeric.
+ */
+
+enum temporal_op_id {
+	PLLUA_TM_NONE = 0,
+
+	/* dyadic, boolean result */
+	PLLUA_TM_EQ,
+	PLLUA_TM_LT,
+	PLLUA_TM_LE,
+
+	/* dyadic */
+	PLLUA_TM_ADD,
+	PLLUA_TM_SUB,
+	PLLUA_TM_MUL,
+	PLLUA_TM_DIV,
+
+	/* monadic but must ignore a second arg */
+	PLLUA_TM_UNM
+};
+
+typedef struct pllua_temporal_op
+{
+	int			op;
+	Oid			left;
+	Oid			right;
+	PGFunction	func;
+	Oid			result;
+} pllua_temporal_op;
+
+/*
+ * Where an operand isn't a temporal datum, the first entry whose other
+ * operand matches decides what it gets converted to; so interval comes first
+ * among the subtractions, and a string on the right of "ts - x" is taken as
+ * an interval.
+ */
+static const pllua_temporal_op temporal_ops[] = {
+	{ PLLUA_TM_EQ, TIMESTAMPOID, TIMESTAMPOID, timestamp_eq, BOOLOID },
+	{ PLLUA_TM_LT, TIMESTAMPOID, TIMESTAMPOID, timestamp_lt, BOOLOID },
+	{ PLLUA_TM_LE, TIMESTAMPOID, TIMESTAMPOID, timestamp_le, BOOLOID },
+	{ PLLUA_TM_EQ, TIMESTAMPTZOID, TIMESTAMPTZOID, timestamp_eq, BOOLOID },
+	{ PLLUA_TM_LT, TIMESTAMPTZOID, TIMESTAMPTZOID, timestamp_lt, BOOLOID },
+	{ PLLUA_TM_LE, TIMESTAMPTZOID, TIMESTAMPTZOID, timestamp_le, BOOLOID },
+	{ PLLUA_TM_EQ, DATEOID, DATEOID, date_eq, BOOLOID },
+	{ PLLUA_TM_LT, DATEOID, DATEOID, date_lt, BOOLOID },
+	{ PLLUA_TM_LE, DATEOID, DATEOID, date_le, BOOLOID },
+	{ PLLUA_TM_EQ, INTERVALOID, INTERVALOID, interval_eq, BOOLOID },
+	{ PLLUA_TM_LT, INTERVALOID, INTERVALOID, interval_lt, BOOLOID },
+	{ PLLUA_TM_LE, INTERVALOID, INTERVALOID, interval_le, BOOLOID },
+
+	{ PLLUA_TM_ADD, TIMESTAMPOID, INTERVALOID, timestamp_pl_interval, TIMESTAMPOID },
+	{ PLLUA_TM_ADD, TIMESTAMPTZOID, INTERVALOID, timestamptz_pl_interval, TIMESTAMPTZOID },
+	{ PLLUA_TM_ADD, DATEOID, INTERVALOID, date_pl_interval, TIMESTAMPOID },
+	{ PLLUA_TM_ADD, DATEOID, INT4OID, date_pli, DATEOID },
+	{ PLLUA_TM_ADD, INTERVALOID, INTERVALOID, interval_pl, INTERVALOID },
+
+	{ PLLUA_TM_SUB, TIMESTAMPOID, INTERVALOID, timestamp_mi_interval, TIMESTAMPOID },
+	{ PLLUA_TM_SUB, TIMESTAMPOID, TIMESTAMPOID, timestamp_mi, INTERVALOID },
+	{ PLLUA_TM_SUB, TIMESTAMPTZOID, INTERVALOID, timestamptz_mi_interval, TIMESTAMPTZOID },
+	{ PLLUA_TM_SUB, TIMESTAMPTZOID, TIMESTAMPTZOID, timestamp_mi, INTERVALOID },
+	{ PLLUA_TM_SUB, DATEOID, INTERVALOID, date_mi_interval, TIMESTAMPOID },
+	{ PLLUA_TM_SUB, DATEOID, INT4OID, date_mii, DATEOID },
+	{ PLLUA_TM_SUB, DATEOID, DATEOID, date_mi, INT4OID },
+	{ PLLUA_TM_SUB, INTERVALOID, INTERVALOID, interval_mi, INTERVALOID },
+
+	{ PLLUA_TM_MUL, INTERVALOID, FLOAT8OID, interval_mul, INTERVALOID },
+	{ PLLUA_TM_DIV, INTERVALOID, FLOAT8OID, interval_div, INTERVALOID },
+
+	{ PLLUA_TM_UNM, INTERVALOID, InvalidOid, interval_um, INTERVALOID },
+
+	{ PLLUA_TM_NONE, InvalidOid, InvalidOid, NULL, InvalidOid }
+};
+
+static const char *const temporal_op_names[] = {
+	NULL, "==", "<", "<=", "+", "-", "*", "/", "unary -"
+};
+
+static bool
+pllua_temporal_istype(Oid typeid)
+{
+	return (typeid == TIMESTAMPOID || typeid == TIMESTAMPTZOID ||
+			typeid == DATEOID || typeid == INTERVALOID);
+}
+
+/*
+ * Upvalue 1 is a table mapping type oids to typeinfo objects.
+ */
+static void
+pllua_temporal_pushtype(lua_State *L, Oid typeid)
+{
+	if (lua_rawgeti(L, lua_upvalueindex(1), (lua_Integer) typeid) != LUA_TUSERDATA)
+		luaL_error(L, "missing typeinfo for type %d", (int) typeid);
+}
+
+/*
+ * Returns the type of the arg if it is a temporal datum, else InvalidOid.
+ */
+static Oid
+pllua_temporal_argtype(lua_State *L, int nd, pllua_datum **dp)
+{
+	pllua_typeinfo *t;
+	pllua_datum *d = pllua_toanydatum(L, nd, &t);
+
+	*dp = NULL;
+	if (!d)
+		return InvalidOid;
+	lua_pop(L, 1);
+	if (!pllua_temporal_istype(t->typeoid))
+		return InvalidOid;
+	*dp = d;
+	return t->typeoid;
+}
+
+static bool
+pllua_temporal_canconvert(lua_State *L, int nd, Oid argtype, Oid target)
+{
+	if (OidIsValid(argtype))
+		return argtype == target;
+
+	switch (target)
+	{
+		case INT4OID:
+			{
+				int isint = 0;
+				lua_Integer v = lua_tointegerx(L, nd, &isint);
+				return (lua_type(L, nd) == LUA_TNUMBER && isint &&
+						v >= PG_INT32_MIN && v <= PG_INT32_MAX);
+			}
+		case FLOAT8OID:
+			return lua_type(L, nd) == LUA_TNUMBER;
+		case InvalidOid:
+			return lua_isnoneornil(L, nd);
+		default:
+			return lua_type(L, nd) != LUA_TNUMBER && !lua_isnoneornil(L, nd);
+	}
+}
+
+/*
+ * Get the value of arg nd as type "target". Non-datum values are converted
+ * with the type's constructor, which leaves a new datum on the stack in place
+ * of the original value. *fbuf must stay live until the value is used, since
+ * float8 may be pass-by-reference.
+ */
+static Datum
+pllua_temporal_getarg(lua_State *L, int nd, pllua_datum *d, Oid target,
+					  float8 *fbuf)
+{
+	if (d)
+		return d->value;
+
+	switch (target)
+	{
+		case INT4OID:
+			return Int32GetDatum((int32) lua_tointeger(L, nd));
+		case FLOAT8OID:
+			*fbuf = (float8) lua_tonumber(L, nd);
+			return Float8GetDatumFast(*fbuf);
+		case InvalidOid:
+			return (Datum)0;
+		default:
+			break;
+	}
+
+	pllua_temporal_pushtype(L, target);
+	lua_pushvalue(L, -1);
+	lua_pushvalue(L, nd);
+	lua_call(L, 1, 1);
+	lua_replace(L, nd);
+	d = pllua_todatum(L, nd, -1);
+	lua_pop(L, 1);
+	if (!d)
+		luaL_error(L, "temporal conversion did not yield a datum");
+	return d->value;
+}
+
+/*
+ * Push the result of calling func on the args, according to the result type.
+ */
+static void
+pllua_temporal_call(lua_State *L, PGFunction func, Oid result,
+					Datum arg1, Datum arg2, int nargs)
+{
+	pllua_datum *d = NULL;
+	pllua_typeinfo *t = NULL;
+	volatile Datum res = (Datum)0;
+
+	if (pllua_temporal_istype(result))
+	{
+		pllua_temporal_pushtype(L, result);
+		t = pllua_totypeinfo(L, -1);
+		d = pllua_newdatum(L, -1, (Datum)0);
+		lua_remove(L, -2);
+	}
+
+	PLLUA_TRY();
+	{
+		Datum		r;
+
+		if (nargs == 1)
+			r = DirectFunctionCall1(func, arg1);
+		else
+			r = DirectFunctionCall2(func, arg1, arg2);
+
+		if (d)
+		{
+			MemoryContext oldcontext = MemoryContextSwitchTo(pllua_get_memory_cxt(L));
+			d->value = r;
+			pllua_savedatum(L, d, t);
+			MemoryContextSwitchTo(oldcontext);
+			/* savedatum copied it; don't leak the original into our caller */
+			if (!t->typbyval && r != arg1 && r != arg2)
+				pfree(DatumGetPointer(r));
+		}
+		else
+			res = r;
+	}
+	PLLUA_CATCH_RETHROW();
+
+	switch (result)
+	{
+		case BOOLOID:
+			lua_pushboolean(L, DatumGetBool(res));
+			break;
+		case INT4OID:
+			lua_pushinteger(L, (lua_Integer) DatumGetInt32(res));
+			break;
+		case FLOAT8OID:
+			lua_pushnumber(L, (lua_Number) DatumGetFloat8(res));
+			break;
+		default:
+			/* datum is already on the stack */
+			break;
+	}
+}
+
+/*
+ * upvalue 1 is the typeinfo table, 2 the opcode
+ */
+static int
+pllua_temporal_handler(lua_State *L)
+{
+	int			op = lua_tointeger(L, lua_upvalueindex(2));
+	const pllua_temporal_op *top = NULL;
+	pllua_datum *d1;
+	pllua_datum *d2;
+	Oid			t1;
+	Oid			t2;
+	Datum		val1;
+	Datum		val2;
+	float8		f1;
+	float8		f2;
+	int			i;
+	bool		swap = false;
+
+	lua_settop(L, 2);
+	t1 = pllua_temporal_argtype(L, 1, &d1);
+	t2 = (op == PLLUA_TM_UNM) ? InvalidOid : pllua_temporal_argtype(L, 2, &d2);
+	if (op == PLLUA_TM_UNM)
+	{
+		d2 = NULL;
+		lua_pushnil(L);
+		lua_replace(L, 2);
+	}
+
+	for (i = 0; temporal_ops[i].op != PLLUA_TM_NONE; ++i)
+	{
+		const pllua_temporal_op *e = &temporal_ops[i];
+
+		if (e->op != op)
+			continue;
+		if (pllua_temporal_canconvert(L, 1, t1, e->left) &&
+			pllua_temporal_canconvert(L, 2, t2, e->right))
+		{
+			top = e;
+			break;
+		}
+		/* addition and multiplication commute */
+		if ((op == PLLUA_TM_ADD || op == PLLUA_TM_MUL) &&
+			pllua_temporal_canconvert(L, 2, t2, e->left) &&
+			pllua_temporal_canconvert(L, 1, t1, e->right))
+		{
+			top = e;
+			swap = true;
+			break;
+		}
+	}
+
+	if (!top)
+	{
+		/* values of unrelated types are just unequal */
+		if (op == PLLUA_TM_EQ)
+		{
+			lua_pushboolean(L, 0);
+			return 1;
+		}
+		return luaL_error(L, "unsupported operand types for temporal %s",
+						  temporal_op_names[op]);
+	}
+
+	if (swap)
+	{
+		pllua_datum *dtmp = d1;
+
+		lua_insert(L, 1);
+		d1 = d2;
+		d2 = dtmp;
+	}
+
+	val1 = pllua_temporal_getarg(L, 1, d1, top->left, &f1);
+	val2 = pllua_temporal_getarg(L, 2, d2, top->right, &f2);
+
+	pllua_temporal_call(L, top->func, top->result, val1, val2,
+						(op == PLLUA_TM_UNM) ? 1 : 2);
+	return 1;
+}
+
+/*
+ * Get arg 1 as a temporal datum, returning its type; dates are converted to
+ * timestamp (in *val) since the helper functions have no date variants.
+ */
+static Oid
+pllua_temporal_getself(lua_State *L, Datum *val)
+{
+	pllua_datum *d;
+	Oid			typeid = pllua_temporal_argtype(L, 1, &d);
+
+	if (!OidIsValid(typeid))
+		luaL_argerror(L, 1, "timestamp, timestamptz, date or interval expected");
+	*val = d->value;
+	if (typeid == DATEOID)
+	{
+		volatile Datum res = (Datum)0;
+
+		PLLUA_TRY();
+		{
+			res = DirectFunctionCall1(date_timestamp, d->value);
+		}
+		PLLUA_CATCH_RETHROW();
+		*val = res;
+	}
+	return typeid;
+}
+
+/*
+ * d:date_trunc(field)
+ *
+ * Dates are truncated as timestamps, and give a timestamp result.
+ */
+static int
+pllua_temporal_date_trunc(lua_State *L)
+{
+	const char *field;
+	Datum		val;
+	Oid			typeid;
+	volatile Datum fieldtxt = (Datum)0;
+
+	lua_settop(L, 2);
+	typeid = pllua_temporal_getself(L, &val);
+	field = luaL_checkstring(L, 2);
+
+	PLLUA_TRY();
+	{
+		fieldtxt = PointerGetDatum(cstring_to_text(field));
+	}
+	PLLUA_CATCH_RETHROW();
+
+	switch (typeid)
+	{
+		case TIMESTAMPTZOID:
+			pllua_temporal_call(L, timestamptz_trunc, TIMESTAMPTZOID, fieldtxt, val, 2);
+			break;
+		case INTERVALOID:
+			pllua_temporal_call(L, interval_trunc, INTERVALOID, fieldtxt, val, 2);
+			break;
+		default:
+			pllua_temporal_call(L, timestamp_trunc, TIMESTAMPOID, fieldtxt, val, 2);
+			break;
+	}
+	return 1;
+}
+
+/*
+ * d:extract(field)  returns a Lua number
+ */
+static int
+pllua_temporal_extract(lua_State *L)
+{
+	const char *field;
+	Datum		val;
+	Oid			typeid;
+	volatile Datum fieldtxt = (Datum)0;
+
+	lua_settop(L, 2);
+	typeid = pllua_temporal_getself(L, &val);
+	field = luaL_checkstring(L, 2);
+
+	PLLUA_TRY();
+	{
+		fieldtxt = PointerGetDatum(cstring_to_text(field));
+	}
+	PLLUA_CATCH_RETHROW();
+
+	switch (typeid)
+	{
+		case TIMESTAMPTZOID:
+			pllua_temporal_call(L, timestamptz_part, FLOAT8OID, fieldtxt, val, 2);
+			break;
+		case INTERVALOID:
+			pllua_temporal_call(L, interval_part, FLOAT8OID, fieldtxt, val, 2);
+			break;
+		default:
+			pllua_temporal_call(L, timestamp_part, FLOAT8OID, fieldtxt, val, 2);
+			break;
+	}
+	return 1;
+}
+
+/*
+ * d1:age(d2)  returns an interval
+ *
+ * d2 is converted to the type of d1 if need be.
+ */
+static int
+pllua_temporal_age(lua_State *L)
+{
+	Datum		val1;
+	Datum		val2;
+	Oid			typeid;
+	pllua_datum *d2;
+	float8		fbuf;
+
+	lua_settop(L, 2);
+	typeid = pllua_temporal_getself(L, &val1);
+	if (typeid == INTERVALOID)
+		luaL_argerror(L, 1, "timestamp, timestamptz or date expected");
+	luaL_checkany(L, 2);
+
+	if (pllua_temporal_argtype(L, 2, &d2) != typeid)
+		d2 = NULL;
+	val2 = pllua_temporal_getarg(L, 2, d2, typeid, &fbuf);
+	if (typeid == DATEOID)
+	{
+		volatile Datum res = (Datum)0;
+
+		PLLUA_TRY();
+		{
+			res = DirectFunctionCall1(date_timestamp, val2);
+		}
+		PLLUA_CATCH_RETHROW();
+		val2 = res;
+	}
+
+	if (typeid == TIMESTAMPTZOID)
+		pllua_temporal_call(L, timestamptz_age, INTERVALOID, val1, val2, 2);
+	else
+		pllua_temporal_call(L, timestamp_age, INTERVALOID, val1, val2, 2);
+	return 1;
+}
+
+static struct { const char *name; enum temporal_op_id id; } temporal_meta[] = {
+	{ "__eq", PLLUA_TM_EQ },
+	{ "__lt", PLLUA_TM_LT },
+	{ "__le", PLLUA_TM_LE },
+	{ "__add", PLLUA_TM_ADD },
+	{ "__sub", PLLUA_TM_SUB },
+	{ "__mul", PLLUA_TM_MUL },
+	{ "__div", PLLUA_TM_DIV },
+	{ "__unm", PLLUA_TM_UNM },
+	{ NULL, PLLUA_TM_NONE }
+};
+
+static luaL_Reg temporal_methods[] = {
+	{ "date_trunc", pllua_temporal_date_trunc },
+	{ "extract", pllua_temporal_extract },
+	{ "age", pllua_temporal_age },
+	{ NULL, NULL }
+};
+
+static Oid temporal_types[] = {
+	TIMESTAMPOID, TIMESTAMPTZOID, DATEOID, INTERVALOID, InvalidOid
+};
+
+int pllua_open_temporal(lua_State *L)
+{
+	int i;
+	int j;
+
+	lua_settop(L, 0);
+	lua_newtable(L);  /* module table at index 1 */
+	lua_newtable(L);  /* typeinfo table at index 2 */
+	for (i = 0; OidIsValid(temporal_types[i]); ++i)
+	{
+		lua_pushcfunction(L, pllua_typeinfo_lookup);
+		lua_pushinteger(L, temporal_types[i]);
+		lua_call(L, 1, 1);
+		lua_rawseti(L, 2, (lua_Integer) temporal_types[i]);
+	}
+
+	lua_pushvalue(L, 1);
+	lua_pushvalue(L, 2);
+	luaL_setfuncs(L, temporal_methods, 1);
+	lua_pop(L, 1);
+
+	for (i = 0; OidIsValid(temporal_types[i]); ++i)
+	{
+		lua_rawgeti(L, 2, (lua_Integer) temporal_types[i]);
+		lua_getuservalue(L, -1);  /* datum metatable */
+		for (j = 0; temporal_meta[j].name; ++j)
+		{
+			lua_pushvalue(L, 2);
+			lua_pushinteger(L, temporal_meta[j].id);
+			lua_pushcclosure(L, pllua_temporal_handler, 2);
+			lua_setfield(L, -2, temporal_meta[j].name);
+		}
+		/* override normal datum __index entry with our method table */
+		lua_pushvalue(L, 1);
+		lua_setfield(L, -2, "__index");
+		lua_pop(L, 2);
+	}
+
+	lua_pushvalue(L, 1);
+	return 1;
+}
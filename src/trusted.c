@@ -755,7 +755,10 @@ static struct module_info sandbox_packages_late[] = {
 	{ "pllua.pgtype",		NULL,	"proxy",	"pgtype"		},
 	{ "pllua.elog",			NULL,	"copy",		NULL			},
 	{ "pllua.numeric",		NULL,	"copy",		NULL			},
+	{ "pllua.temporal",		NULL,	"copy",		NULL			},
 	{ "pllua.jsonb",		NULL,	"copy",		NULL			},
+	{ "pllua.json",			NULL,	"copy",		NULL			},
+	{ "pllua.hashmap",		NULL,	"copy",		NULL			},
 	{ NULL, NULL }
 };
 
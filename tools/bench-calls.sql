@@ -0,0 +1,52 @@
+-- bench-calls.sql
+--
+-- Microbenchmark for the cost of interrupt checking on call-heavy Lua
+-- code. Run with psql against a database with the pllua extension:
+--
+--   psql -X -f tools/bench-calls.sql
+--
+-- and compare the timings with pllua.check_for_interrupts on and off,
+-- and for different values of pllua.interrupt_check_interval. Each
+-- setting needs a fresh session since the hook is installed when the
+-- interpreter is created. Needs superuser to change the settings.
+
+\timing on
+
+create function bench_fib(n integer) returns bigint
+  language pllua
+as $$
+  local function fib(k)
+    if k < 2 then return k end
+    return fib(k-1) + fib(k-2)
+  end
+  return fib(n)
+$$;
+
+create function bench_calls(n integer) returns bigint
+  language pllua
+as $$
+  local function id(x) return x end
+  local s = 0
+  for i = 1,n do s = s + id(i) end
+  return s
+$$;
+
+\c
+set pllua.check_for_interrupts = off;
+select bench_fib(27);
+select bench_calls(10000000);
+
+\c
+set pllua.check_for_interrupts = on;
+set pllua.interrupt_check_interval = 10000;
+select bench_fib(27);
+select bench_calls(10000000);
+
+\c
+set pllua.check_for_interrupts = on;
+set pllua.interrupt_check_interval = 100;
+select bench_fib(27);
+select bench_calls(10000000);
+
+drop function bench_fib(integer);
+drop function bench_calls(integer);